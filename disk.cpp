@@ -8,12 +8,37 @@
 #include <string>
 #include <sstream>
 #include <map>
+#include <list>
+#include <set>
+#include <deque>
+#include <queue>
+#include <functional>
 #include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <cstdint>
 #include <ctime>
 #include <algorithm>
+#include <random>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <unordered_map>
+#include <climits>
 #include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <iomanip>
+#include <fstream>
 
 using namespace std;
 
@@ -21,12 +46,16 @@ using namespace std;
 const int MAXTRACKS = 1000;
 
 // States that a request/disk go through
-enum State {
+enum State : uint8_t {
     STATE_NULL = 0,
     STATE_SEEK = 1,
     STATE_ROTATE = 2,
     STATE_XFER = 3,
-    STATE_DONE = 4
+    STATE_DONE = 4,
+    STATE_IDLE = 5,
+    STATE_MERGED = 6,
+    STATE_TIER = 7,
+    STATE_MIGRATE = 8
 };
 
 // Structure to hold block information
@@ -41,633 +70,4961 @@ struct BlockInfo {
 struct Request {
     int block;
     int index;
-    Request(int b, int i) : block(b), index(i) {}
+    int length;
+    bool write;
+    bool submitted;  // through the service queue
+    int stream;
+    double arrival;
+    int id;
+    Request(int b, int i, bool w = false) : block(b), index(i), length(1), write(w), submitted(false), stream(0), arrival(0), id(i) {}
 };
 
-// Disk class
-class Disk {
+// The requests to run, numbered by id (late requests after the others).
+// Once made it is only read, so devices running it can share one copy.
+// streamCount covers streams named by '@N' as well as those from -W.
+struct Workload {
+    vector<Request> requests;
+    vector<Request> lateRequests;
+    int streamCount = 0;
+};
+
+// What the schedulers scan for each queued request, in 8 bytes, so that a
+// window of candidates streams through memory eight to a cache line
+// rather than one 40-byte Request plus a separate state array. The disk
+// has three tracks of at most 180 blocks and every I/O, merged or not,
+// fits on it, so length and track fit their narrow fields.
+struct PackedRequest {
+    int32_t block;
+    int16_t length;
+    uint8_t track;
+    State state;
+};
+
+#ifdef DISK_SOA_QUEUE
+// Structure-of-arrays layout (-DDISK_SOA_QUEUE): each field in its own
+// array, so skipping requests that are not pending reads only states
+class PendingQueue {
+public:
+    struct Ref {
+        int32_t& block;
+        int16_t& length;
+        uint8_t& track;
+        State& state;
+    };
+    Ref operator[](size_t i) { return Ref{block[i], length[i], track[i], state[i]}; }
+    void push_back(const PackedRequest& r) {
+        block.push_back(r.block);
+        length.push_back(r.length);
+        track.push_back(r.track);
+        state.push_back(r.state);
+    }
+    size_t size() const { return state.size(); }
+    void reserve(size_t n) {
+        block.reserve(n);
+        length.reserve(n);
+        track.reserve(n);
+        state.reserve(n);
+    }
+
 private:
-    // Configuration
-    string addr;
-    string addrDesc;
-    string lateAddr;
-    string lateAddrDesc;
-    string policy;
-    double seekSpeed;
-    double rotateSpeed;
-    int skew;
-    int window;
-    bool compute;
-    bool graphics;
-    string zoning;
+    vector<int32_t> block;
+    vector<int16_t> length;
+    vector<uint8_t> track;
+    vector<State> state;
+};
+#else
+typedef vector<PackedRequest> PendingQueue;
+#endif
 
-    // Disk geometry
-    vector<BlockInfo> blockInfoList;
-    map<int, int> blockToTrackMap;
-    map<int, double> blockToAngleMap;
-    map<int, pair<int, int>> tracksBeginEnd;
-    vector<int> blockAngleOffset;
+// Per-stream weight, fair-queueing tags and completion stats
+struct StreamInfo {
+    double weight;
+    int pending;
+    double vfinish;
+    int completed;
+    int blocks;
+    double busy;
+    double latencyTotal;
+    double latencyMax;
+    double lastDone;
+    int future;
+    int lastBlock;
+    double thinkMean;
+    double seekMean;
+    int anticHits;
+    int anticMisses;
+    StreamInfo(double w) : weight(w), pending(0), vfinish(0), completed(0), blocks(0),
+                           busy(0), latencyTotal(0), latencyMax(0), lastDone(0), future(0),
+                           lastBlock(-1), thinkMean(0), seekMean(0), anticHits(0), anticMisses(0) {}
+};
+
+// Count-min sketch of access frequencies, halved every sampleSize
+// increments so old popularity fades (the TinyLFU admission filter)
+class FrequencySketch {
+public:
+    void Init(int capacity) {
+        width = 1;
+        while (width < 8 * (size_t)capacity) width <<= 1;
+        counters.assign(DEPTH * width, 0);
+        sampleSize = 10 * capacity;
+        additions = 0;
+    }
+
+    void Increment(int key) {
+        for (int row = 0; row < DEPTH; row++) {
+            uint8_t& counter = counters[Index(key, row)];
+            if (counter < 15) counter++;
+        }
+        if (++additions >= sampleSize) {
+            for (uint8_t& counter : counters) counter >>= 1;
+            additions /= 2;
+        }
+    }
+
+    int Estimate(int key) const {
+        int estimate = 15;
+        for (int row = 0; row < DEPTH; row++) {
+            estimate = min(estimate, (int)counters[Index(key, row)]);
+        }
+        return estimate;
+    }
+
+private:
+    static const int DEPTH = 4;
+    size_t width;
+    vector<uint8_t> counters;
+    int sampleSize;
+    int additions;
+
+    size_t Index(int key, int row) const {
+        static const uint64_t seeds[DEPTH] = {0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+                                              0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL};
+        uint64_t h = ((uint64_t)key + 1) * seeds[row];
+        h ^= h >> 29;
+        return row * width + (h & (width - 1));
+    }
+};
+
+// Address generators for random workloads. Each draws one block at a time
+// from [minBlock, maxBlock]; Issued() tells it the length finally used.
+class AddressGenerator {
+public:
+    virtual ~AddressGenerator() {}
+    virtual int Next() = 0;
+    virtual void Issued(int, int) {}
+};
+
+// Uniform addresses from rand(), as the simulator has always drawn them
+class UniformGenerator : public AddressGenerator {
+public:
+    UniformGenerator(int minBlock, int maxBlock) : minBlock(minBlock), maxBlock(maxBlock) {}
+    int Next() override { return (rand() % (maxBlock - minBlock + 1)) + minBlock; }
+
+private:
+    int minBlock;
     int maxBlock;
+};
 
-    // Track information
-    map<int, double> tracks;
-    double trackWidth;
+// Zipf-distributed popularity (rank r drawn with weight 1/r^theta), with
+// ranks scattered over the range. Sampling uses an alias table, so each
+// draw is O(1) after O(n) setup.
+class ZipfGenerator : public AddressGenerator {
+public:
+    ZipfGenerator(int minBlock, int maxBlock, double theta, mt19937& rng) : rng(rng) {
+        int n = maxBlock - minBlock + 1;
+        vector<double> scaled(n);
+        double sum = 0;
+        for (int r = 0; r < n; r++) {
+            scaled[r] = 1.0 / pow(r + 1, theta);
+            sum += scaled[r];
+        }
 
-    // Arm position and movement
-    int armTrack;
-    double armSpeedBase;
-    double armSpeed;
-    double armX1, armX2;
-    double armTargetX1;
-    int armTarget;
+        // Vose's alias method: pair each light column with a heavy one
+        prob.assign(n, 1.0);
+        alias.resize(n);
+        for (int i = 0; i < n; i++) {
+            alias[i] = i;
+        }
+        vector<int> small, large;
+        for (int r = 0; r < n; r++) {
+            scaled[r] *= n / sum;
+            (scaled[r] < 1.0 ? small : large).push_back(r);
+        }
+        while (!small.empty() && !large.empty()) {
+            int light = small.back();
+            int heavy = large.back();
+            small.pop_back();
+            prob[light] = scaled[light];
+            alias[light] = heavy;
+            scaled[heavy] -= 1.0 - scaled[light];
+            if (scaled[heavy] < 1.0) {
+                large.pop_back();
+                small.push_back(heavy);
+            }
+        }
 
-    // Request queue
-    vector<Request> requestQueue;
-    vector<State> requestState;
-    int requestCount;
-    int currentIndex;
-    int currentBlock;
+        blockOfRank.resize(n);
+        for (int r = 0; r < n; r++) {
+            blockOfRank[r] = minBlock + r;
+        }
+        shuffle(blockOfRank.begin(), blockOfRank.end(), rng);
+    }
 
-    // Late requests
-    vector<int> requests;
-    vector<int> lateRequests;
-    int lateCount;
+    int Next() override {
+        int column = uniform_int_distribution<int>(0, prob.size() - 1)(rng);
+        double coin = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return blockOfRank[coin < prob[column] ? column : alias[column]];
+    }
 
-    // Scheduling window
-    int currWindow;
-    int fairWindow;
+private:
+    mt19937& rng;
+    vector<double> prob;
+    vector<int> alias;
+    vector<int> blockOfRank;
+};
 
-    // Simulation state
-    State state;
-    double angle;
-    double timer;
+// accessPercent of the accesses go to the lowest spacePercent of the range
+class HotspotGenerator : public AddressGenerator {
+public:
+    HotspotGenerator(int minBlock, int maxBlock, double accessPercent, double spacePercent, mt19937& rng)
+        : minBlock(minBlock), maxBlock(maxBlock), accessPercent(accessPercent), rng(rng) {
+        int n = maxBlock - minBlock + 1;
+        hotEnd = minBlock + max(1, min(n, (int)ceil(n * spacePercent / 100.0))) - 1;
+    }
 
-    // Timing
-    double seekBegin, rotBegin, xferBegin;
-    double seekTotal, rotTotal, xferTotal;
-    double totalEst;
+    int Next() override {
+        bool hot = uniform_real_distribution<double>(0.0, 100.0)(rng) < accessPercent;
+        if (hot || hotEnd == maxBlock) {
+            return uniform_int_distribution<int>(minBlock, hotEnd)(rng);
+        }
+        return uniform_int_distribution<int>(hotEnd + 1, maxBlock)(rng);
+    }
 
-    // Control
-    bool isDone;
+private:
+    int minBlock;
+    int maxBlock;
+    int hotEnd;
+    double accessPercent;
+    mt19937& rng;
+};
 
+// Interleaved sequential streams: each starts at a random block and
+// carries on where its previous request ended, wrapping at the end
+class SequentialGenerator : public AddressGenerator {
 public:
-    Disk(const string& addr, const string& addrDesc, const string& lateAddr,
-         const string& lateAddrDesc, const string& policy, double seekSpeed,
-         double rotateSpeed, int skew, int window, bool compute, bool graphics,
-         const string& zoning);
+    SequentialGenerator(int minBlock, int maxBlock, int count, mt19937& rng)
+        : minBlock(minBlock), maxBlock(maxBlock), next(0) {
+        for (int i = 0; i < count; i++) {
+            cursors.push_back(uniform_int_distribution<int>(minBlock, maxBlock)(rng));
+        }
+    }
 
-    void Go();
+    int Next() override { return cursors[next]; }
+
+    void Issued(int block, int length) override {
+        cursors[next] = block + length > maxBlock ? minBlock : block + length;
+        next = (next + 1) % cursors.size();
+    }
 
 private:
-    void InitBlockLayout();
-    vector<int> MakeRequests(const string& addr, const string& addrDesc);
-    void PrintAddrDescMessage(const string& value);
+    int minBlock;
+    int maxBlock;
+    vector<int> cursors;
+    size_t next;
+};
 
-    void GetNextIO();
-    void Animate();
-    void UpdateTime();
-    void DoRequestStats();
-    void PrintStats();
+// Each draw comes from one of several generators, picked by weight
+class MixtureGenerator : public AddressGenerator {
+public:
+    MixtureGenerator(vector<unique_ptr<AddressGenerator>> parts, const vector<double>& weights, mt19937& rng)
+        : parts(move(parts)), pick(weights.begin(), weights.end()), rng(rng), last(0) {}
 
-    pair<int, int> DoSATF(const vector<Request>& rList);
-    vector<Request> DoSSTF(const vector<Request>& rList);
-    void PlanSeek(int track);
-    bool DoneWithSeek();
-    bool DoneWithRotation();
-    bool DoneWithTransfer();
-    bool RadiallyCloseTo(double a1, double a2);
+    int Next() override {
+        last = pick(rng);
+        return parts[last]->Next();
+    }
 
-    void SwitchState(State newState);
-    void AddRequest(int block);
-    int GetWindow();
-    void UpdateWindow();
+    void Issued(int block, int length) override { parts[last]->Issued(block, length); }
 
-    vector<string> Split(const string& s, char delimiter);
+private:
+    vector<unique_ptr<AddressGenerator>> parts;
+    discrete_distribution<int> pick;
+    mt19937& rng;
+    int last;
 };
 
-// Helper function to split strings
-vector<string> Disk::Split(const string& s, char delimiter) {
-    vector<string> tokens;
-    stringstream ss(s);
-    string token;
-    while (getline(ss, token, delimiter)) {
-        tokens.push_back(token);
+#ifdef DISK_COUNTERS
+// Hot-path counters, compiled in with -DDISK_COUNTERS. They are printed to
+// stderr at the end of Go(), so stdout matches an uninstrumented build.
+// Map lookups are also counted by the estimators the OPT and LSATF
+// planners run on several threads, so that counter is atomic.
+struct Counters {
+    long long ticks = 0;
+    long long satfCalls = 0;
+    long long satfCandidates = 0;
+    atomic<long long> mapLookups{0};
+    double setupTime = 0;
+    double scheduleTime = 0;
+    double runTime = 0;
+};
+
+// Adds the wall-clock time spent in its scope to a counter
+class PhaseTimer {
+public:
+    PhaseTimer(double& total) : total(total), start(chrono::steady_clock::now()) {}
+    ~PhaseTimer() { total += chrono::duration<double>(chrono::steady_clock::now() - start).count(); }
+
+private:
+    double& total;
+    chrono::steady_clock::time_point start;
+};
+
+#define COUNT(field, n) (counters.field += (n))
+#define TIME_PHASE(field) PhaseTimer phaseTimer(counters.field)
+#else
+#define COUNT(field, n) ((void)0)
+#define TIME_PHASE(field) ((void)0)
+#endif
+
+// Per-Disk slab allocator for the scheduler's node-based containers.
+// Nodes come from 64 KiB slabs, one free list per 16-byte size class, and
+// go back on their free list when erased, so once a run has warmed up its
+// inserts and erases never reach malloc. The slabs are released all at
+// once with the Disk.
+class Arena {
+public:
+    Arena() : slabUsed(SLAB_SIZE), slabCount(0), largeCount(0) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() {
+        for (char* slab : slabs) {
+            delete[] slab;
+        }
+    }
+
+    void* Allocate(size_t bytes) {
+        if (bytes > MAX_NODE) {
+            largeCount++;
+            return ::operator new(bytes);
+        }
+        size_t sizeClass = (bytes + ALIGN - 1) / ALIGN;
+        if (freeLists[sizeClass]) {
+            void* node = freeLists[sizeClass];
+            freeLists[sizeClass] = *static_cast<void**>(node);
+            return node;
+        }
+        if (slabUsed + sizeClass * ALIGN > SLAB_SIZE) {
+            slabs.push_back(new char[SLAB_SIZE]);
+            slabUsed = 0;
+            slabCount++;
+        }
+        void* node = slabs.back() + slabUsed;
+        slabUsed += sizeClass * ALIGN;
+        return node;
+    }
+
+    void Release(void* node, size_t bytes) {
+        if (bytes > MAX_NODE) {
+            ::operator delete(node);
+            return;
+        }
+        size_t sizeClass = (bytes + ALIGN - 1) / ALIGN;
+        *static_cast<void**>(node) = freeLists[sizeClass];
+        freeLists[sizeClass] = node;
+    }
+
+    int SlabCount() const { return slabCount; }
+    int LargeCount() const { return largeCount; }
+
+private:
+    static const size_t ALIGN = 16;
+    static const size_t MAX_NODE = 1024;
+    static const size_t SLAB_SIZE = 64 * 1024;
+    vector<char*> slabs;
+    size_t slabUsed;
+    void* freeLists[MAX_NODE / ALIGN + 1] = {};
+    int slabCount;
+    int largeCount;
+};
+
+template <typename T>
+class PoolAllocator {
+public:
+    typedef T value_type;
+    PoolAllocator(Arena* arena) : arena(arena) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : arena(other.arena) {}
+    T* allocate(size_t n) { return static_cast<T*>(arena->Allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { arena->Release(p, n * sizeof(T)); }
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const { return arena != other.arena; }
+
+    Arena* arena;
+};
+
+template <typename T> using PoolList = list<T, PoolAllocator<T>>;
+template <typename T> using PoolDeque = deque<T, PoolAllocator<T>>;
+template <typename T> using PoolSet = set<T, less<T>, PoolAllocator<T>>;
+template <typename K, typename V> using PoolMap = map<K, V, less<K>, PoolAllocator<pair<const K, V>>>;
+template <typename K, typename V> using PoolMultimap = multimap<K, V, less<K>, PoolAllocator<pair<const K, V>>>;
+
+// Queue entries by index, in pages of 4096. Once every entry on a page has
+// been released its storage goes (one page is kept for reuse), so a long
+// trace only holds the requests still in play. Indexes and references
+// stay valid until their entry is released.
+template <typename T>
+class PagedQueue {
+public:
+    static const size_t PAGE = 4096;
+
+    T& operator[](size_t i) { return pages[i / PAGE][i % PAGE]; }
+    const T& operator[](size_t i) const { return pages[i / PAGE][i % PAGE]; }
+    size_t size() const { return count; }
+
+    void push_back(const T& item) {
+        if (count % PAGE == 0) {
+            pages.emplace_back();
+            released.push_back(0);
+            if (spare.capacity() > 0) {
+                pages.back().swap(spare);
+            } else {
+                pages.back().reserve(PAGE);
+            }
+        }
+        pages.back().push_back(item);
+        count++;
+    }
+
+    // Entry i is no longer needed
+    void Release(size_t i) {
+        size_t page = i / PAGE;
+        if (++released[page] < PAGE) {
+            return;
+        }
+        if (spare.capacity() == 0) {
+            pages[page].clear();
+            pages[page].swap(spare);
+        } else {
+            vector<T>().swap(pages[page]);
+        }
+    }
+
+private:
+    vector<vector<T>> pages;
+    vector<size_t> released;
+    vector<T> spare;
+    size_t count = 0;
+};
+
+// One worker thread per hardware thread after the first, started on first
+// use and kept for the life of the program. The caller runs the first
+// share of each job itself. One job runs at a time; a caller that finds
+// the pool busy (another disk of a comparison) runs its job alone.
+class WorkerPool {
+public:
+    static WorkerPool& Get() {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    int Size() const { return threads.size() + 1; }
+
+    // Run body(worker, begin, end) over [0, count) in up to Size() shares
+    void Run(int count, const function<void(int, int, int)>& body) {
+        int shares = min<int>(count, Size());
+        unique_lock<mutex> running(runLock, try_to_lock);
+        if (shares <= 1 || !running.owns_lock()) {
+            body(0, 0, count);
+            return;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            job = &body;
+            jobCount = count;
+            jobShares = shares;
+            remaining = shares - 1;
+            generation++;
+        }
+        wake.notify_all();
+        body(0, 0, count / shares);
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [this] { return remaining == 0; });
+        job = nullptr;
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& t : threads) {
+            t.join();
+        }
+    }
+
+private:
+    WorkerPool() {
+        int extra = max(1u, thread::hardware_concurrency()) - 1;
+        for (int w = 1; w <= extra; w++) {
+            threads.push_back(thread(&WorkerPool::Work, this, w));
+        }
+    }
+
+    void Work(int worker) {
+        uint64_t seen = 0;
+        while (true) {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            if (worker >= jobShares) {
+                continue;
+            }
+            const function<void(int, int, int)>& body = *job;
+            int begin = (long long)jobCount * worker / jobShares;
+            int end = (long long)jobCount * (worker + 1) / jobShares;
+            guard.unlock();
+            body(worker, begin, end);
+            guard.lock();
+            if (--remaining == 0) {
+                done.notify_one();
+            }
+        }
+    }
+
+    mutex runLock;
+    mutex lock;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(int, int, int)>* job = nullptr;
+    int jobCount = 0;
+    int jobShares = 0;
+    int remaining = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+    vector<thread> threads;
+};
+
+// Run body(worker, begin, end) over [0, count), split evenly across the
+// hardware threads; worker is below WorkerPool::Get().Size(). The body is
+// passed on by reference, so a lambda with many captures is not copied to
+// the heap for every call.
+template <typename Body>
+static void ParallelFor(int count, const Body& body) {
+    WorkerPool::Get().Run(count, cref(body));
+}
+
+// LSATF's memo of access estimates. Every step out of a partial sequence
+// starts from the same place (the request it ended on, or -1 for the arm)
+// at the same start angle in 1/4096 degree, so the memo keeps one row of
+// estimates per such start, filled in as candidates are reached (NaN
+// until then). Rows are found in an open-addressed table; a new stamp
+// empties it for the next dispatch without touching the slots.
+class LookaheadMemo {
+public:
+    static const int ANGLE_STEPS = 4096;
+
+    void Clear(int width) {
+        if (++stamp == 0) {
+            slots.assign(slots.size(), Slot());
+            stamp = 1;
+        }
+        used = 0;
+        rows.clear();
+        rowWidth = width;
+    }
+
+    // Offset in Cells() of the row for a start, added if it is new
+    size_t Row(int from, int64_t angleStep) {
+        uint64_t key = ((uint64_t)(from + 1) << 32) | (uint64_t)angleStep;
+        if ((used + 1) * 2 > slots.size()) {
+            Grow();
+        }
+        size_t i = Hash(key);
+        for (; slots[i].stamp == stamp; i = (i + 1) & (slots.size() - 1)) {
+            if (slots[i].key == key) {
+                return slots[i].row;
+            }
+        }
+        slots[i] = Slot{key, rows.size(), stamp};
+        used++;
+        rows.resize(rows.size() + rowWidth, NAN);
+        return slots[i].row;
+    }
+
+    double* Cells() { return rows.data(); }
+
+private:
+    struct Slot {
+        uint64_t key = 0;
+        size_t row = 0;
+        uint32_t stamp = 0;
+    };
+    vector<Slot> slots;
+    size_t used = 0;
+    uint32_t stamp = 1;
+    vector<double> rows;
+    int rowWidth = 0;
+
+    size_t Hash(uint64_t key) const { return (key * 0x9E3779B97F4A7C15ull) >> 32 & (slots.size() - 1); }
+
+    void Grow() {
+        vector<Slot> old;
+        old.swap(slots);
+        slots.assign(max<size_t>(1024, old.size() * 2), Slot());
+        for (const Slot& slot : old) {
+            if (slot.stamp == stamp) {
+                size_t i = Hash(slot.key);
+                while (slots[i].stamp == stamp) {
+                    i = (i + 1) & (slots.size() - 1);
+                }
+                slots[i] = slot;
+            }
+        }
+    }
+};
+
+// A drive model from a profile file. Times are in milliseconds; options
+// the profile does not set are left as given on the command line
+struct DriveProfile {
+    string name;
+    double rpm = 0;
+    double seekMs = 0;           // one-track seek
+    vector<double> seekCurveMs;  // seek of 1, 2, ... tracks
+    double headSwitchMs = 0;     // to the next track within one I/O; 0 = seek
+    double blockKiB = 4;
+    string zoning;
+    int skew = -1;
+    double rotateSpeed = 0;
+    int cacheBlocks = -1;
+};
+
+static string Trim(const string& s) {
+    size_t begin = s.find_first_not_of(" \t\r");
+    if (begin == string::npos) {
+        return "";
+    }
+    return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+}
+
+// Parse every [name] section of an INI-style profile file: key = value
+// lines, with # or ; starting a comment
+map<string, shared_ptr<const DriveProfile>> LoadProfiles(const string& path) {
+    ifstream in(path);
+    if (!in) {
+        cerr << "Cannot open profile file " << path << endl;
+        exit(1);
+    }
+    map<string, shared_ptr<const DriveProfile>> profiles;
+    shared_ptr<DriveProfile> current;
+    string line;
+    int lineNumber = 0;
+    while (getline(in, line)) {
+        lineNumber++;
+        line = Trim(line.substr(0, line.find_first_of("#;")));
+        if (line.empty()) {
+            continue;
+        }
+        if (line[0] == '[' && line.back() == ']') {
+            current = make_shared<DriveProfile>();
+            current->name = Trim(line.substr(1, line.size() - 2));
+            profiles[current->name] = current;
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (!current || equals == string::npos) {
+            cerr << path << ":" << lineNumber << ": expected [name] or key = value" << endl;
+            exit(1);
+        }
+        string key = Trim(line.substr(0, equals));
+        string value = Trim(line.substr(equals + 1));
+        if (key == "rpm") {
+            current->rpm = stod(value);
+        } else if (key == "seek") {
+            current->seekMs = stod(value);
+        } else if (key == "seekCurve") {
+            stringstream ss(value);
+            string token;
+            while (getline(ss, token, ',')) {
+                current->seekCurveMs.push_back(stod(token));
+            }
+        } else if (key == "headSwitch") {
+            current->headSwitchMs = stod(value);
+        } else if (key == "block") {
+            current->blockKiB = stod(value);
+        } else if (key == "zoning") {
+            current->zoning = value;
+        } else if (key == "skew") {
+            current->skew = stoi(value);
+        } else if (key == "rotSpeed") {
+            current->rotateSpeed = stod(value);
+        } else if (key == "cache") {
+            current->cacheBlocks = stoi(value);
+        } else {
+            cerr << path << ":" << lineNumber << ": unknown key " << key << endl;
+            exit(1);
+        }
+    }
+    for (auto& entry : profiles) {
+        const DriveProfile& profile = *entry.second;
+        if (profile.rpm <= 0 || (profile.seekMs <= 0 && profile.seekCurveMs.empty())) {
+            cerr << "Profile " << profile.name << " needs rpm and seek or seekCurve" << endl;
+            exit(1);
+        }
+    }
+    return profiles;
+}
+
+// Binary trace format: a header, then one fixed-size record per request
+// in arrival order. Fields are in host byte order.
+struct TraceHeader {
+    char magic[8];       // "DISKTRC1"
+    uint64_t count;
+    uint32_t lastBlock;  // highest block any record touches
+    uint32_t streams;    // highest stream number + 1
+};
+
+struct TraceRecord {
+    double arrival;      // in ticks
+    uint32_t block;
+    uint16_t length;
+    uint8_t write;
+    uint8_t stream;
+};
+
+static_assert(sizeof(TraceHeader) == 24 && sizeof(TraceRecord) == 16, "trace layout");
+
+// A binary trace mapped read-only into memory. Records are read in place,
+// so opening a trace costs the same whatever its size and replay reads
+// pages in as it reaches them.
+class TraceReader {
+public:
+    explicit TraceReader(const string& path) : path(path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            cerr << "Cannot open trace file " << path << endl;
+            exit(1);
+        }
+        bytes = info.st_size;
+        base = bytes > 0 ? mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (base == MAP_FAILED) {
+            cerr << "Cannot map trace file " << path << endl;
+            exit(1);
+        }
+        madvise(base, bytes, MADV_SEQUENTIAL);
+
+        header = static_cast<const TraceHeader*>(base);
+        if (bytes < sizeof(TraceHeader) || string(header->magic, 8) != "DISKTRC1") {
+            cerr << "Trace file " << path << " is not a binary trace (convert it with -J)" << endl;
+            exit(1);
+        }
+        // Requests are numbered with an int
+        if (header->count > INT_MAX) {
+            cerr << "Trace file " << path << " has " << header->count << " records, more than the "
+                 << INT_MAX << " a run can number" << endl;
+            exit(1);
+        }
+        if (bytes != sizeof(TraceHeader) + header->count * sizeof(TraceRecord)) {
+            cerr << "Trace file " << path << " is not a binary trace (convert it with -J)" << endl;
+            exit(1);
+        }
+        records = reinterpret_cast<const TraceRecord*>(header + 1);
+    }
+    ~TraceReader() { munmap(base, bytes); }
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    const string& Path() const { return path; }
+    size_t Size() const { return header->count; }
+    int LastBlock() const { return header->lastBlock; }
+    int Streams() const { return header->streams; }
+    const TraceRecord& operator[](size_t i) const { return records[i]; }
+
+private:
+    string path;
+    void* base;
+    size_t bytes;
+    const TraceHeader* header;
+    const TraceRecord* records;
+};
+
+static bool IsBinaryTrace(const string& path) {
+    ifstream in(path, ios::binary);
+    char magic[8] = {};
+    in.read(magic, 8);
+    return in && string(magic, 8) == "DISKTRC1";
+}
+
+// Find the next c in [p, end), or end, sixteen bytes at a time where SSE2
+// is available
+static const char* FindByte(const char* p, const char* end, char c) {
+#ifdef __SSE2__
+    const __m128i target = _mm_set1_epi8(c);
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, target));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != c) {
+        p++;
+    }
+    return p;
+}
+
+static bool ParseUnsigned(const char* p, const char* end, uint64_t& value) {
+    if (p == end || end - p > 12) {
+        return false;
+    }
+    value = 0;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+        value = value * 10 + (*p - '0');
+    }
+    return true;
+}
+
+static bool ParseDecimal(const char* p, const char* end, double& value) {
+    const char* point = FindByte(p, end, '.');
+    uint64_t whole;
+    if (!ParseUnsigned(p, point, whole)) {
+        return false;
+    }
+    value = whole;
+    if (point == end) {
+        return true;
+    }
+    double scale = 0.1;
+    for (p = point + 1; p < end; p++, scale *= 0.1) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+        value += (*p - '0') * scale;
+    }
+    return true;
+}
+
+// Parse one text trace line: arrival,block[,length[,op[,stream]]] with op
+// r or w
+static bool ParseTraceLine(const char* p, const char* end, TraceRecord& record) {
+    record = TraceRecord{0, 0, 1, 0, 0};
+    uint64_t value;
+    const char* field = FindByte(p, end, ',');
+    if (!ParseDecimal(p, field, record.arrival) || field == end) {
+        return false;
+    }
+    p = field + 1;
+    field = FindByte(p, end, ',');
+    if (!ParseUnsigned(p, field, value) || value > UINT32_MAX) {
+        return false;
+    }
+    record.block = value;
+    if (field == end) {
+        return true;
+    }
+    p = field + 1;
+    field = FindByte(p, end, ',');
+    if (!ParseUnsigned(p, field, value) || value < 1 || value > UINT16_MAX) {
+        return false;
+    }
+    record.length = value;
+    if (field == end) {
+        return true;
+    }
+    p = field + 1;
+    field = FindByte(p, end, ',');
+    if (field - p != 1 || (*p != 'r' && *p != 'R' && *p != 'w' && *p != 'W')) {
+        return false;
+    }
+    record.write = (*p == 'w' || *p == 'W');
+    if (field == end) {
+        return true;
+    }
+    if (!ParseUnsigned(field + 1, end, value) || value > UINT8_MAX) {
+        return false;
+    }
+    record.stream = value;
+    return true;
+}
+
+// Parses a text trace on worker threads. The mapped file is split into
+// chunks at line boundaries; workers claim chunks in order and parse each
+// into a slot of a bounded ring, and NextBatch hands the batches back in
+// file order, so no more than the ring's size are parsed ahead of the
+// reader. Blank lines and lines starting with # are skipped.
+class TraceParser {
+public:
+    explicit TraceParser(const string& path, size_t chunkBytes = 1 << 20)
+        : path(path), base(nullptr), bytes(0), chunkBytes(chunkBytes) {
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            cerr << "Cannot open trace file " << path << endl;
+            exit(1);
+        }
+        bytes = info.st_size;
+        if (bytes > 0) {
+            base = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED) {
+                cerr << "Cannot map trace file " << path << endl;
+                exit(1);
+            }
+            madvise(base, bytes, MADV_SEQUENTIAL);
+        }
+        close(fd);
+        text = static_cast<const char*>(base);
+        chunks = (bytes + chunkBytes - 1) / chunkBytes;
+
+        int threads = max(1u, thread::hardware_concurrency());
+        ring.resize(2 * threads);
+        for (int t = 0; t < threads; t++) {
+            workers.push_back(thread(&TraceParser::Work, this));
+        }
+    }
+
+    ~TraceParser() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        slotFree.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+        if (base) {
+            munmap(base, bytes);
+        }
+    }
+
+    TraceParser(const TraceParser&) = delete;
+    TraceParser& operator=(const TraceParser&) = delete;
+
+    const string& Path() const { return path; }
+
+    // The next chunk's records, in file order; false once the file is done.
+    // Exits on a malformed line or an arrival earlier than the one before.
+    bool NextBatch(vector<TraceRecord>& batch) {
+        if (consumed == chunks) {
+            return false;
+        }
+        Slot& slot = ring[consumed % ring.size()];
+        {
+            unique_lock<mutex> guard(lock);
+            slotReady.wait(guard, [&slot] { return slot.ready; });
+        }
+        size_t badLine = slot.badLine;
+        if (badLine == 0 && !slot.records.empty() && slot.records.front().arrival < lastArrival) {
+            badLine = slot.firstLine;
+        }
+        if (badLine > 0) {
+            cerr << path << ":" << lineBase + badLine << ": expected arrival,block[,length[,op[,stream]]]"
+                 << " with arrivals in order" << endl;
+            exit(1);
+        }
+        batch.swap(slot.records);
+        if (!batch.empty()) {
+            lastArrival = batch.back().arrival;
+        }
+        lineBase += slot.lines;
+        {
+            lock_guard<mutex> guard(lock);
+            slot.ready = false;
+            consumed++;
+        }
+        slotFree.notify_all();
+        return true;
+    }
+
+private:
+    struct Slot {
+        vector<TraceRecord> records;
+        size_t lines = 0;      // lines in the chunk
+        size_t firstLine = 0;  // of the first record, counting from 1
+        size_t badLine = 0;    // first malformed or out-of-order line
+        bool ready = false;
+    };
+
+    // Chunk c holds the lines that start in [c, c + 1) * chunkBytes
+    size_t ChunkStart(size_t chunk) const {
+        if (chunk == 0) {
+            return 0;
+        }
+        if (chunk >= chunks) {
+            return bytes;
+        }
+        const char* newline = FindByte(text + chunk * chunkBytes - 1, text + bytes, '\n');
+        return min(bytes, (size_t)(newline - text) + 1);
+    }
+
+    void ParseChunk(size_t chunk, Slot& slot) const {
+        const char* p = text + ChunkStart(chunk);
+        const char* stop = text + ChunkStart(chunk + 1);
+        slot.records.reserve((stop - p) / 16);
+        while (p < stop) {
+            const char* newline = FindByte(p, stop, '\n');
+            const char* end = (newline > p && newline[-1] == '\r') ? newline - 1 : newline;
+            slot.lines++;
+            if (end > p && *p != '#') {
+                TraceRecord record;
+                if (!ParseTraceLine(p, end, record) ||
+                    (!slot.records.empty() && record.arrival < slot.records.back().arrival)) {
+                    slot.badLine = slot.lines;
+                    return;
+                }
+                if (slot.records.empty()) {
+                    slot.firstLine = slot.lines;
+                }
+                slot.records.push_back(record);
+            }
+            p = newline + 1;
+        }
+    }
+
+    void Work() {
+        while (true) {
+            size_t chunk;
+            {
+                unique_lock<mutex> guard(lock);
+                slotFree.wait(guard, [this] {
+                    return stopping || claimed == chunks || claimed < consumed + ring.size();
+                });
+                if (stopping || claimed == chunks) {
+                    return;
+                }
+                chunk = claimed++;
+            }
+            Slot parsed;
+            ParseChunk(chunk, parsed);
+            parsed.ready = true;
+            {
+                lock_guard<mutex> guard(lock);
+                ring[chunk % ring.size()] = move(parsed);
+            }
+            slotReady.notify_all();
+        }
+    }
+
+    string path;
+    void* base;
+    size_t bytes;
+    const char* text;
+    size_t chunkBytes;
+    size_t chunks;
+
+    vector<Slot> ring;
+    mutex lock;
+    condition_variable slotFree;
+    condition_variable slotReady;
+    size_t claimed = 0;
+    size_t consumed = 0;
+    bool stopping = false;
+
+    // Reader's position, for error messages and the order check
+    size_t lineBase = 0;
+    double lastArrival = 0;
+
+    vector<thread> workers;
+};
+
+// Fixed-size ring between exactly one producer thread and one consumer
+// thread. Each side owns one index and only reads the other's, so neither
+// takes a lock; the indices sit on separate cache lines.
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    bool TryPush(const T& item) {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t - head.load(memory_order_acquire) == slots.size()) {
+            return false;
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& item) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h == tail.load(memory_order_acquire)) {
+            return false;
+        }
+        item = slots[h & mask];
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    void Pop(T& item) {
+        while (!TryPop(item)) {
+            this_thread::yield();
+        }
+    }
+
+private:
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head{0};
+    alignas(64) atomic<size_t> tail{0};
+};
+
+// Bounded queue for any number of producer threads and one consumer.
+// Each cell carries a sequence number saying whose turn it is, so
+// producers claim cells with one compare-and-swap on the tail and the
+// consumer never contends with them (Vyukov's bounded queue).
+template <typename T>
+class MpscQueue {
+public:
+    explicit MpscQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    bool TryPush(const T& item) {
+        size_t pos = tail.load(memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(memory_order_acquire);
+            intptr_t turn = (intptr_t)sequence - (intptr_t)pos;
+            if (turn == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    cell.value = item;
+                    cell.sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            } else if (turn < 0) {
+                return false;
+            } else {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TryPop(T& item) {
+        Cell& cell = cells[head & mask];
+        if (cell.sequence.load(memory_order_acquire) != head + 1) {
+            return false;
+        }
+        item = cell.value;
+        cell.sequence.store(head + mask + 1, memory_order_release);
+        head++;
+        return true;
+    }
+
+    bool Empty() const {
+        return cells[head & mask].sequence.load(memory_order_acquire) != head + 1;
+    }
+
+private:
+    struct Cell {
+        atomic<size_t> sequence;
+        T value;
+    };
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) atomic<size_t> tail{0};
+    alignas(64) size_t head = 0;
+};
+
+// Hashed timing wheel: an item goes in the slot for its due time, and
+// advancing the wheel one slot fires the items there that are due, so
+// adding and firing cost O(1) each however many items are waiting. Items
+// due more than a turn ahead wait in their slot for the later turn.
+template <typename T>
+class TimerWheel {
+public:
+    explicit TimerWheel(size_t slotCount) : slots(slotCount), current(0), count(0) {}
+
+    // Add an item due at the given slot time; times already passed fire
+    // at the next Advance
+    void Add(uint64_t due, T item) {
+        due = max(due, current);
+        slots[due % slots.size()].push_back(Entry{due, move(item)});
+        count++;
+    }
+
+    // Fire, in due order, every item due up to and including now
+    template <typename F>
+    void Advance(uint64_t now, F fire) {
+        for (; current <= now; current++) {
+            if (count == 0) {
+                current = now + 1;
+                break;
+            }
+            vector<Entry>& slot = slots[current % slots.size()];
+            size_t kept = 0;
+            for (size_t i = 0; i < slot.size(); i++) {
+                if (slot[i].due <= current) {
+                    fire(slot[i].item);
+                    count--;
+                } else {
+                    slot[kept++] = move(slot[i]);
+                }
+            }
+            slot.erase(slot.begin() + kept, slot.end());
+        }
+    }
+
+    bool Empty() const { return count == 0; }
+
+private:
+    struct Entry {
+        uint64_t due;
+        T item;
+    };
+    vector<vector<Entry>> slots;
+    uint64_t current;
+    size_t count;
+};
+
+// A submitted request that has completed. Times are in ticks; in real-time
+// mode, due is the wall-clock moment the completion was scheduled for.
+struct IoCompletion {
+    int id;
+    int block;
+    int length;
+    bool write;
+    double arrival;
+    double finish;
+    chrono::steady_clock::time_point due;
+};
+
+using IoCallback = function<void(const IoCompletion&)>;
+
+// Simulation options, as given on the command line
+struct DiskConfig {
+    string addr = "-1";
+    string addrDesc = "5,-1,0";
+    string lateAddr = "-1";
+    string lateAddrDesc = "0,-1,0";
+    string policy = "FIFO";
+    double seekSpeed = 1;
+    double rotateSpeed = 1;
+    int skew = 0;
+    int window = -1;
+    bool compute = false;
+    bool graphics = false;
+    string zoning = "30,30,30";
+    string deadline = "500,5000,16,2";
+    string streamWeights = "1";
+    int fairBudget = 4;
+    string kyber = "1000,5000,16,16";
+    int thinkTime = -1;
+    int antic = 0;
+    int maxMerge = 1;
+    string lengthDesc = "1,1";
+    string device = "disk";
+    string flash = "2,2,1,16,4";
+    string flashTiming = "2,20,130,1";
+    string tier = "0,2,20,40";
+    string dist = "uniform";
+    int sample = 0;
+    string sampleFile = "samples.txt";
+    bool quiet = false;
+    string opt = "16,64";
+    string lookahead = "3,8";
+    int tables = 0;
+    string units;
+    shared_ptr<const DriveProfile> profile;  // seek curve and head switch
+    shared_ptr<const TraceReader> trace;     // replay instead of making requests
+    shared_ptr<TraceParser> textTrace;       // replay while parsing; one disk only
+    bool pipeline = false;                   // read trace and print on own threads
+    int serviceDepth = 0;                    // accept submissions; 0 = off
+    double realtime = 0;                     // wall time per tick, in ticks (-u) or us
+    shared_ptr<const Workload> workload;  // run this instead of making requests
+    bool workloadOnly = false;               // stop once the workload is made
+};
+
+// Disk class
+class Disk {
+private:
+    // Backs the request queues and indices below; declared first so it
+    // outlives them
+    Arena arena;
+
+    // Configuration
+    string addr;
+    string addrDesc;
+    string lateAddr;
+    string lateAddrDesc;
+    string policy;
+    double seekSpeed;
+    double rotateSpeed;
+    int skew;
+    int window;
+    bool compute;
+    bool graphics;
+    string zoning;
+    string deadline;
+    string streamWeights;
+    string kyber;
+    int thinkTime;
+    int anticExpire;
+    string lengthDesc;
+    string tier;
+    string dist;
+    mt19937 workloadRng;
+    int sampleInterval;
+    string sampleFile;
+    bool quiet;
+    string units;
+    shared_ptr<const DriveProfile> profile;
+
+    // Trace to replay, and the next record to arrive: from a binary trace,
+    // or from batches of a text trace as they are parsed
+    shared_ptr<const TraceReader> trace;
+    size_t traceNext;
+    shared_ptr<TraceParser> textTrace;
+    vector<TraceRecord> textBatch;
+
+    // With pipeline, a reader thread feeds trace records in through one
+    // ring and a writer thread formats per-I/O lines from another, so the
+    // simulation thread neither parses nor formats. A record of length 0
+    // ends the arrivals; one with block -1 ends the output.
+    struct IoLine {
+        int block;
+        int seek;
+        int rotate;
+        int transfer;
+        int total;
+        int length;
+        bool hit;
+    };
+    bool pipeline;
+    unique_ptr<SpscRing<TraceRecord>> arrivalRing;
+    thread arrivalThread;
+    atomic<bool> arrivalStop;
+    TraceRecord nextArrival;
+    bool arrivalHeld;
+    bool arrivalsDone;
+    unique_ptr<SpscRing<IoLine>> outputRing;
+    thread outputThread;
+
+    // Service mode: requests submitted by other threads, at most
+    // serviceDepth of them in the device at once
+    int serviceDepth;
+    struct Submission {
+        TraceRecord record;
+        IoCallback done;
+    };
+    unique_ptr<MpscQueue<Submission>> submissions;
+    unordered_map<int, IoCallback> callbacks;
+    atomic<int> inFlight;
+    atomic<bool> serviceClosed;
+    atomic<long long> submitWaits;
+
+    // Either side of the service spins briefly, then sleeps until the
+    // other wakes it. Wakers only take serviceLock when someone sleeps.
+    static const int SERVICE_SPINS = 64;
+    mutex serviceLock;
+    condition_variable submitted;  // the disk waits for work
+    condition_variable placeFreed;  // submitters wait for a place
+    atomic<bool> diskAsleep;
+    atomic<int> submittersAsleep;
+    int peakDepth;
+    int submittedCount;
+
+    // Real-time pacing: the clock is held to wallPerTick microseconds of
+    // wall time per tick, and completions are passed to a timer thread that
+    // runs their callbacks from a timer wheel at the moment they are due
+    double wallPerTick;
+    chrono::steady_clock::time_point paceStart;
+    struct Timed {
+        IoCompletion completion;
+        IoCallback done;
+    };
+    unique_ptr<SpscRing<Timed>> completionRing;
+    thread timerThread;
+    atomic<long long> lateCallbacks;
+
+    // Disk geometry
+    vector<BlockInfo> blockInfoList;
+    map<int, int> blockToTrackMap;
+    map<int, double> blockToAngleMap;
+    map<int, pair<int, int>> tracksBeginEnd;
+    vector<int> blockAngleOffset;
+    int maxBlock;
+
+    // Track information
+    map<int, double> tracks;
+    double trackWidth;
+
+    // Physical calibration from units: microseconds per tick, ticks per
+    // one-track seek and block size; tickMicros is 0 without units
+    double tickMicros;
+    int seekTicks;
+    double blockKiB;
+
+    // From a profile: seek ticks by tracks moved (from 0), and ticks to
+    // move on to the next track partway through an I/O; both empty/0 keep
+    // seeks linear at seekSpeed
+    vector<double> seekCurve;
+    double headSwitchTicks;
+    bool switching;
+
+    // Optional lookup tables for access estimates, built with the layout
+    // when they fit in tableLimit KiB and every entry is a whole number of
+    // ticks, so that table and formula agree exactly: seek time by (from,
+    // to) track, and rotational delay by block and platter angle on arrival
+    int tableLimit;
+    bool useTables;
+    string tableStatus;
+    int tableTracks;
+    vector<double> tableCenter;
+    vector<int> tableTrack;
+    vector<int> tableTrackLast;
+    vector<double> seekTable;
+    vector<double> rotTable;
+    size_t tableBytes;
+
+    // Arm position and movement
+    int armTrack;
+    double armSpeedBase;
+    double armSpeed;
+    double armX1, armX2;
+    double armTargetX1;
+    int armTarget;
+
+    // Request queue. A completed I/O's requests are released from
+    // requestQueue when the next I/O completes; pending keeps every state.
+    PagedQueue<Request> requestQueue;
+    int lastServed = -1;  // leader of the I/O completed last
+    PendingQueue pending;
+    vector<Request> candidateList;  // reused by policies that pick from a subset
+    vector<int> mergedNext;  // next request served by the same I/O, or -1
+    vector<int> mergedLast;  // last request of the I/O a leader heads
+    int requestCount;
+    int fifoNext;
+    int currentIndex;
+    int currentBlock;
+
+    // The part of the current I/O on one track: an I/O that runs past the
+    // end of a track switches tracks and carries on from the next one
+    int segmentBlock;
+    int segmentEnd;
+    double ioBegin;
+    double ioSeek, ioRot, ioXfer;
+
+    // The workload; late requests are added one per I/O started
+    shared_ptr<const Workload> workload;
+    int lateCount;
+    vector<double> latencyById;
+
+    // Scheduling window
+    int currWindow;
+    int fairWindow;
+
+    // Deadline scheduler: per-direction (0 = read, 1 = write) block-sorted
+    // sets and arrival-ordered FIFOs of pending request indices
+    double readExpire;
+    double writeExpire;
+    int fifoBatch;
+    int writesStarved;
+    PoolSet<pair<int, int>> deadlineSorted[2] = {PoolSet<pair<int, int>>(&arena), PoolSet<pair<int, int>>(&arena)};
+    PoolDeque<int> deadlineFifo[2] = {PoolDeque<int>(&arena), PoolDeque<int>(&arena)};
+    int deadlineDir;
+    int deadlineNext;
+    int deadlineBatch;
+    int deadlineStarved;
+    int deadlineMissed;
+    int deadlineExpired;
+    int deadlineStarvations;
+
+    // Request streams; BFQ serves the active stream until it has used
+    // fairBudget blocks, then picks the stream with the smallest virtual
+    // finish time
+    vector<StreamInfo> streams;
+    int fairBudget;
+    int fairActive;
+    int fairUsed;
+    double fairStart;
+    double fairVirtualTime;
+
+    // Kyber: each class (0 = read, 1 = write) may have at most kyberDepth
+    // requests admitted to the dispatch set; depths are adjusted from the
+    // latencies observed in DoRequestStats
+    double kyberTarget[2];
+    int kyberMaxDepth;
+    int kyberWindow;
+    int kyberDepth[2];
+    int kyberInflight[2];
+    int kyberThrottled[2];
+    PoolDeque<int> kyberQueue[2] = {PoolDeque<int>(&arena), PoolDeque<int>(&arena)};
+    vector<int> kyberAdmitted;
+    vector<double> kyberSamples[2];
+    vector<double> kyberLatencies[2];
+
+    // OPT: when the first I/O is picked, plan the order of the whole
+    // (static) request list that minimizes the SATF cost model's total
+    // time, then serve it in that order. Up to optExact requests the plan
+    // is exact: dynamic programming over (served set, last request),
+    // keeping only the earliest finish, which is safe because finishing
+    // earlier never makes the next request finish later. Larger lists use
+    // a beam search keeping the optBeam best partial orders.
+    string opt;
+    int optExact;
+    int optBeam;
+    bool optPlanned;
+    deque<int> optOrder;
+    vector<int> optPending;
+    vector<double> optEndX;
+    double optArmX;
+    double optAngle;
+    double optEstimate;
+    double optGreedy;
+    long long optStates;
+
+    // LSATF: pick the request that starts the sequence of lookaheadDepth
+    // requests finishing soonest. Each first candidate is searched in
+    // parallel, keeping the lookaheadBeam best partial sequences per
+    // level; access estimates are memoized by (from, to, start angle)
+    // within a dispatch. Candidates and search state are kept between
+    // dispatches, one scratch set per pool worker.
+    struct LookaheadPath {
+        double time;
+        vector<int> steps;
+    };
+    struct LookaheadStep {
+        double time;
+        int path;
+        int next;
+    };
+    struct LookaheadScratch {
+        LookaheadMemo memo;
+        vector<LookaheadPath> beam;
+        vector<LookaheadPath> next;
+        vector<LookaheadStep> steps;
+        long long evaluated = 0;
+        long long memoHits = 0;
+    };
+    string lookahead;
+    int lookaheadDepth;
+    int lookaheadBeam;
+    long long lookaheadEvaluated;
+    long long lookaheadMemoHits;
+    int lookaheadChanged;
+    vector<int> lookaheadCandidates;
+    vector<double> lookaheadEndX;
+    vector<double> lookaheadFirst;
+    vector<double> lookaheadBest;
+    vector<LookaheadScratch> lookaheadScratch;
+
+    // Requests that arrive later in simulated time, keyed by arrival time.
+    // With a think time, each stream issues its scripted requests one at a
+    // time, thinkTime ticks after the previous one completes.
+    PoolMultimap<double, Request> futureRequests{&arena};
+    vector<PoolDeque<Request>> streamScript;
+
+    // Merging: contiguous pending requests of the same stream and direction
+    // are combined into a single I/O of up to maxMerge blocks. The
+    // first-arrived request leads the I/O and chains the ones it absorbed,
+    // in order, through mergedNext. Leaders are indexed by their first and last block;
+    // several pending I/Os may share a block.
+    int maxMerge;
+    PoolMultimap<int, int> mergeByStart{&arena};
+    PoolMultimap<int, int> mergeByEnd{&arena};
+    int backMerges;
+    int frontMerges;
+    int coalesced;
+
+    // Fast tier: up to tierCapacity blocks cached in LRU order. An I/O
+    // whose blocks are all cached is served from it at tierHitTime per
+    // block without touching the arm. After each I/O, uncached blocks are
+    // promoted if the sketch says they are hotter than the LRU victim;
+    // promotions, and write-backs of dirty victims, keep the device busy.
+    struct TierEntry {
+        PoolList<int>::iterator lru;
+        bool dirty;
+    };
+    int tierCapacity;
+    double tierHitTime;
+    double tierPromoteTime;
+    double tierDemoteTime;
+    PoolList<int> tierLru{&arena};
+    PoolMap<int, TierEntry> tierBlocks{&arena};
+    FrequencySketch tierSketch;
+    bool ioFromTier;
+    double tierDone;
+    double migrateDone;
+    int tierHits;
+    int tierMisses;
+    int tierPromoted;
+    int tierDemoted;
+    int tierRejected;
+    double migrateTotal;
+
+    // Anticipation: after a completion, idle up to anticExpire ticks for
+    // the same stream's next request instead of seeking away
+    int anticStream;
+    double anticDeadline;
+    int anticWaits;
+    int anticHits;
+    int anticTimeouts;
+    double idleTotal;
+
+    // Simulation state
+    State state;
+    double angle;
+    double timer;
+
+    // Timing
+    double seekBegin, rotBegin, xferBegin;
+    double seekTotal, rotTotal, xferTotal;
+    double totalEst;
+
+    // Control
+    bool isDone;
+
+    // Every sampleInterval ticks, how the device spent them, the queue
+    // depth, arm track and completions are recorded into a ring of
+    // samples, which is written out in columns whenever it fills
+    struct Sample {
+        double time;
+        int depth;
+        int ticks;
+        int busy;
+        int seek;
+        int rotate;
+        int xfer;
+        int track;
+        int completed;
+    };
+    vector<Sample> sampleRing;
+    size_t sampleNext;
+    int sampleTicks[STATE_MIGRATE + 1];
+    int sampleCompleted;
+    ofstream sampleOut;
+    void SampleTick(State ticked);
+    void TakeSample();
+    void FlushSamples();
+
+#ifdef DISK_COUNTERS
+    // Mutable so the const estimators can count their map lookups
+    mutable Counters counters;
+    void PrintCounters();
+#endif
+
+public:
+    Disk(const DiskConfig& config);
+    ~Disk();
+
+    void Go();
+
+    // Service mode (serviceDepth > 0): any thread may submit requests while
+    // Go() runs. TrySubmit fails while serviceDepth submitted requests are
+    // in the device, and Submit waits for room. Go() idles, without the
+    // clock moving, while there is nothing to do, and returns once Close()
+    // has been called and every request is done.
+    // Each may be given a callback for when the request completes: on the
+    // simulation thread, or in real-time mode on a timer thread when the
+    // completion is due in wall-clock time. Go() returns after the last.
+    bool TrySubmit(int block, int length = 1, bool write = false, int stream = 0,
+                   IoCallback done = nullptr);
+    void Submit(int block, int length = 1, bool write = false, int stream = 0,
+                IoCallback done = nullptr);
+    future<IoCompletion> SubmitAsync(int block, int length = 1, bool write = false, int stream = 0);
+    void Close();
+    long long SubmitWaits() const { return submitWaits; }
+    int PeakDepth() const { return peakDepth; }
+
+    // The generated workload, for running it on another device model
+    const vector<Request>& Requests() const { return workload->requests; }
+    const vector<Request>& LateRequests() const { return workload->lateRequests; }
+    shared_ptr<const Workload> SharedWorkload() const { return workload; }
+
+    // Make (or parse) and print the workload a config describes, without
+    // building tables, queues or threads for a run
+    static shared_ptr<const Workload> MakeWorkload(const DiskConfig& config);
+    const vector<StreamInfo>& Streams() const { return streams; }
+    int MaxBlock() const { return maxBlock; }
+
+    // Time totals once Go() has finished
+    double SeekTotal() const { return seekTotal; }
+    double RotateTotal() const { return rotTotal; }
+    double TransferTotal() const { return xferTotal; }
+    double TotalTime() const { return timer; }
+    double TickMicros() const { return tickMicros; }
+    double BlockKiB() const { return blockKiB; }
+    const vector<double>& Latencies() const { return latencyById; }
+
+private:
+    void InitBlockLayout();
+    void InitUnits();
+    double SeekTime(double distance, bool headSwitch) const;
+    void InitTables();
+    vector<Request> MakeRequests(const string& addr, const string& addrDesc);
+    Request ParseRequest(const string& token);
+    unique_ptr<AddressGenerator> MakeGenerator(const string& spec, int minBlock, int maxBlock);
+    void PrintRequests(const string& label, const vector<Request>& rList);
+    void PrintAddrDescMessage(const string& value);
+    void InitDeadline();
+    void InitStreams();
+    void InitKyber();
+    void InitTier();
+    void InitOpt();
+    void InitLookahead();
+
+    void GetNextIO();
+    void Animate();
+    void UpdateTime();
+    void DoRequestStats();
+    void PrintStats();
+
+    pair<int, int> DoSATF(const vector<Request>& rList);
+    pair<int, int> DoSATF(int endIndex);
+    void EstimateChosen(int index);
+    void DoSSTF(int endIndex);
+    pair<int, int> DoDeadline();
+    void DeadlineDispatch(int dir, int block, int index);
+    pair<int, int> DoFair();
+    pair<int, int> DoKyber();
+    pair<int, int> DoOpt();
+    void PlanOpt();
+    double OptFinish(int from, int to, double start) const;
+    vector<int> OptExact();
+    vector<int> OptBeam();
+    pair<int, int> DoLookahead();
+    void SchedulerFeedback(const Request& req, double latency);
+    bool ShouldAnticipate(const Request& req);
+    void Anticipate();
+    void Unqueue(int index);
+    void StartIO(int block, int index);
+    void ReleaseArrivals();
+    void ReleaseTrace();
+    void QueueTraceRecord(const TraceRecord& record);
+    void QueueTextRecord(const TraceRecord& record);
+    void AddStreams(int stream);
+    void ReadArrivals(shared_ptr<TraceParser> text);
+    void WriteOutput();
+    void FinishOutput();
+    void FinishTimers();
+    void DrainSubmissions();
+    bool WaitForSubmission();
+    void Complete(const Request& req);
+    void Pace();
+    void RunTimers();
+    bool ArrivalsPending() const;
+    void MergeRequest(int index);
+    bool TryMerge(int first, int second);
+    void MergeIndexInsert(int index);
+    void MergeIndexErase(int index);
+    bool TierHit(const Request& io);
+    double TierUpdate(const Request& io);
+    void MarkDone();
+    void CompleteIO(int prevBlock);
+    void NextIO(int prevBlock);
+    double EstimateAccess(const Request& req);
+    double EstimateAccessFrom(const Request& req, double armX, double startAngle) const;
+    bool TableEstimate(int block, int length, int track, double armX, double startAngle, double& estimate) const;
+    void StartSegment(int block);
+    void PlanSeek(int track);
+    bool DoneWithSeek();
+    bool DoneWithRotation();
+    bool DoneWithTransfer();
+    bool RadiallyCloseTo(double a1, double a2);
+
+    void SwitchState(State newState);
+    void AddRequest(const Request& req);
+    int GetWindow();
+    int WindowEnd();
+    void UpdateWindow();
+
+    vector<string> Split(const string& s, char delimiter);
+};
+
+// Value below which the fraction p of the samples fall. The samples are
+// reordered in place rather than copied.
+double Percentile(vector<double>& samples, double p) {
+    if (samples.empty()) {
+        return 0;
+    }
+    size_t k = (size_t)ceil(p * samples.size()) - 1;
+    if (k >= samples.size()) k = samples.size() - 1;
+    nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
+}
+
+// Per-stream completions, busy time, latency and throughput
+void PrintStreamStats(const vector<StreamInfo>& streams) {
+    for (size_t s = 0; s < streams.size(); s++) {
+        const StreamInfo& stream = streams[s];
+        double avgLatency = stream.completed ? stream.latencyTotal / stream.completed : 0;
+        // Throughput while the stream had work, i.e. up to its last completion
+        double throughput = stream.lastDone > 0 ? stream.blocks * 1000.0 / stream.lastDone : 0;
+        cout << "STREAM " << setw(3) << s
+             << "  Weight:" << setw(3) << stream.weight
+             << "  Requests:" << setw(3) << stream.completed
+             << "  Busy:" << setw(4) << (int)stream.busy
+             << "  Latency avg:" << fixed << setprecision(1) << setw(7) << avgLatency
+             << " max:" << setw(5) << (int)stream.latencyMax
+             << "  Blocks/1000:" << setw(6) << throughput << endl;
+        cout.unsetf(ios::fixed);
+        cout << setprecision(6);
+    }
+}
+
+// Helper function to split strings
+vector<string> Disk::Split(const string& s, char delimiter) {
+    vector<string> tokens;
+    stringstream ss(s);
+    string token;
+    while (getline(ss, token, delimiter)) {
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+// Constructor
+Disk::Disk(const DiskConfig& config)
+    : addr(config.addr), addrDesc(config.addrDesc), lateAddr(config.lateAddr),
+      lateAddrDesc(config.lateAddrDesc), policy(config.policy),
+      seekSpeed(config.seekSpeed), rotateSpeed(config.rotateSpeed), skew(config.skew),
+      window(config.window), compute(config.compute), graphics(config.graphics),
+      zoning(config.zoning), deadline(config.deadline),
+      streamWeights(config.streamWeights), kyber(config.kyber),
+      thinkTime(config.thinkTime), anticExpire(config.antic),
+      lengthDesc(config.lengthDesc), tier(config.tier), dist(config.dist),
+      sampleInterval(config.sample), sampleFile(config.sampleFile), quiet(config.quiet),
+      units(config.units), profile(config.profile), trace(config.trace), traceNext(0),
+      textTrace(config.textTrace), pipeline(config.pipeline), arrivalStop(false),
+      arrivalHeld(false), arrivalsDone(false), serviceDepth(config.serviceDepth), inFlight(0),
+      serviceClosed(false), submitWaits(0), diskAsleep(false), submittersAsleep(0), peakDepth(0),
+      submittedCount(0), wallPerTick(0), lateCallbacks(0), tableLimit(config.tables), fairBudget(config.fairBudget),
+      opt(config.opt), lookahead(config.lookahead), maxMerge(config.maxMerge) {
+    TIME_PHASE(setupTime);
+
+    // Track info
+    trackWidth = 40;
+    tracks[0] = 140;
+    tracks[1] = tracks[0] - trackWidth;
+    tracks[2] = tracks[1] - trackWidth;
+
+    InitUnits();
+    if (config.realtime < 0) {
+        cerr << "Real-time scale (" << config.realtime << ") must not be negative" << endl;
+        exit(1);
+    }
+    wallPerTick = config.realtime * (tickMicros > 0 ? tickMicros : 1.0);
+    if (tickMicros == 0 && seekSpeed > 1 && ((int)trackWidth % (int)seekSpeed != 0)) {
+        cerr << "Seek speed (" << seekSpeed << ") must divide evenly into track width (" << trackWidth << ")" << endl;
+        exit(1);
+    }
+    armSpeedBase = seekSpeed;
+    
+    // Initialize block layout
+    InitBlockLayout();
+    if (!config.workloadOnly) {
+        InitTables();
+    }
+    InitDeadline();
+    InitStreams();
+    InitKyber();
+    InitTier();
+    InitOpt();
+    InitLookahead();
+
+    // Make requests, unless given a workload to share
+    if (config.workload) {
+        workload = config.workload;
+    } else if (trace) {
+        if (trace->LastBlock() > maxBlock) {
+            cerr << "Trace " << trace->Path() << " reaches block " << trace->LastBlock()
+                 << ", past the end of the disk (" << maxBlock << ")" << endl;
+            exit(1);
+        }
+        workload = make_shared<Workload>();
+    } else if (textTrace) {
+        workload = make_shared<Workload>();
+    } else {
+        shared_ptr<Workload> made(new Workload);
+        made->requests = MakeRequests(addr, addrDesc);
+        made->lateRequests = MakeRequests(lateAddr, lateAddrDesc);
+        for (size_t i = 0; i < made->requests.size(); i++) {
+            made->requests[i].id = i;
+        }
+        for (size_t i = 0; i < made->lateRequests.size(); i++) {
+            made->lateRequests[i].id = made->requests.size() + i;
+        }
+        made->streamCount = streams.size();
+        workload = made;
+    }
+    int streamCount = trace ? trace->Streams() : workload->streamCount;
+    while ((int)streams.size() < streamCount) {
+        streams.push_back(StreamInfo(1));
+    }
+    // Trace requests are added to the per-request arrays as they arrive
+    latencyById.assign(workload->requests.size() + workload->lateRequests.size(), 0);
+    pending.reserve(latencyById.size());
+    mergedNext.reserve(latencyById.size());
+    mergedLast.reserve(latencyById.size());
+
+    // Fairness window
+    if (this->policy == "BSATF" && this->window != -1) {
+        fairWindow = this->window;
+    } else {
+        fairWindow = -1;
+    }
+
+    if (!quiet && trace) {
+        cout << "TRACE " << trace->Path() << "  Records: " << trace->Size() << endl << endl;
+    } else if (!quiet && textTrace) {
+        cout << "TRACE " << textTrace->Path() << endl << endl;
+    } else if (!quiet) {
+        PrintRequests("REQUESTS", workload->requests);
+    }
+
+    if (!quiet && !workload->lateRequests.empty()) {
+        PrintRequests("LATE REQUESTS", workload->lateRequests);
+    }
+
+    if (!quiet && !this->compute) {
+        cout << endl;
+        cout << "For the requests above, compute the seek, rotate, and transfer times." << endl;
+        cout << "Use -c to see the answers." << endl;
+        cout << endl;
+    }
+    if (config.workloadOnly) {
+        return;
+    }
+
+
+    // Arm initialization
+    armTrack = 0;
+    armSpeed = seekSpeed;
+    
+    // BUG FIX 1: The arm's X position must be initialized to the
+    // center of the starting track (Track 0), not 0.
+    armX1 = tracks[armTrack] - (trackWidth / 2.0);
+    armX2 = armX1 + trackWidth;
+
+
+    // Angle and timer
+    angle = 0.0;
+    timer = 0;
+
+    // Request queue initialization
+    requestCount = 0;
+    fifoNext = 0;
+    backMerges = 0;
+    frontMerges = 0;
+    coalesced = 0;
+    if (maxMerge < 1) {
+        cerr << "Maximum merge size (" << maxMerge << ") must be at least one block" << endl;
+        exit(1);
+    }
+    streamScript.resize(streams.size(), PoolDeque<Request>(&arena));
+    for (size_t i = 0; i < workload->requests.size(); i++) {
+        const Request& req = workload->requests[i];
+        if (thinkTime >= 0 && (streams[req.stream].pending > 0 || streams[req.stream].future > 0)) {
+            streamScript[req.stream].push_back(req);
+            streams[req.stream].future++;
+        } else {
+            AddRequest(req);
+        }
+    }
+    if (serviceDepth > 0) {
+        if (trace || textTrace) {
+            cerr << "Service mode takes submitted requests, not a trace" << endl;
+            exit(1);
+        }
+        submissions.reset(new MpscQueue<Submission>(serviceDepth));
+        callbacks.reserve(serviceDepth);
+    }
+    if (pipeline && (trace || textTrace)) {
+        arrivalRing.reset(new SpscRing<TraceRecord>(4096));
+        arrivalThread = thread(&Disk::ReadArrivals, this, textTrace);
+        textTrace.reset();
+    }
+    ReleaseTrace();
+
+    // Anticipation
+    anticStream = -1;
+    anticDeadline = 0;
+    anticWaits = 0;
+    anticHits = 0;
+    anticTimeouts = 0;
+    idleTotal = 0;
+
+    // Scheduling window
+    currWindow = this->window;
+
+    // Initial state
+    currentIndex = -1;
+    currentBlock = -1;
+    state = STATE_NULL;
+
+    // Stats
+    seekTotal = 0.0;
+    rotTotal = 0.0;
+    xferTotal = 0.0;
+
+    // Late requests
+    lateCount = 0;
+
+    // Sampling
+    if (sampleInterval < 0) {
+        cerr << "Sample interval (" << sampleInterval << ") must be positive, or 0 for no sampling" << endl;
+        exit(1);
+    }
+    sampleRing.resize(sampleInterval > 0 ? 1024 : 0);
+    sampleNext = 0;
+    fill(sampleTicks, sampleTicks + STATE_MIGRATE + 1, 0);
+    sampleCompleted = 0;
+
+    // Control
+    isDone = false;
+}
+
+void Disk::InitBlockLayout() {
+    vector<string> zones = Split(zoning, ',');
+    if (zones.size() != 3) {
+        cerr << "Zoning must have exactly 3 values" << endl;
+        exit(1);
+    }
+
+    for (size_t i = 0; i < zones.size(); i++) {
+        if (!quiet) {
+            cout << "z " << i << " " << zones[i] << endl;
+        }
+        blockAngleOffset.push_back(stoi(zones[i]) / 2);
+    }
+
+    // Outer track (track 0)
+    int track = 0;
+    int angleOffset = 2 * blockAngleOffset[track];
+    int block = 0;
+    for (int angle = 0; angle < 360; angle += angleOffset) {
+        block = angle / angleOffset;
+        if (!quiet) {
+            cout << track << " " << angleOffset << " " << block << endl;
+        }
+        blockToTrackMap[block] = track;
+        blockToAngleMap[block] = angle;
+        blockInfoList.push_back(BlockInfo(track, angle, block));
+    }
+    tracksBeginEnd[track] = make_pair(0, block);
+    int pblock = block + 1;
+
+    // Middle track (track 1)
+    track = 1;
+    int skewVal = this->skew;
+    angleOffset = 2 * blockAngleOffset[track];
+    for (int angle = 0; angle < 360; angle += angleOffset) {
+        block = (angle / angleOffset) + pblock;
+        if (!quiet) {
+            cout << track << " " << skewVal << " " << angleOffset << " " << block << endl;
+        }
+        blockToTrackMap[block] = track;
+        blockToAngleMap[block] = angle + (angleOffset * skewVal);
+        blockInfoList.push_back(BlockInfo(track, angle + (angleOffset * skewVal), block));
+    }
+    tracksBeginEnd[track] = make_pair(pblock, block);
+    pblock = block + 1;
+
+    // Inner track (track 2)
+    track = 2;
+    skewVal = 2 * this->skew;
+    angleOffset = 2 * blockAngleOffset[track];
+    for (int angle = 0; angle < 360; angle += angleOffset) {
+        block = (angle / angleOffset) + pblock;
+        if (!quiet) {
+            cout << track << " " << skewVal << " " << angleOffset << " " << block << endl;
+        }
+        blockToTrackMap[block] = track;
+        blockToAngleMap[block] = angle + (angleOffset * skewVal);
+        blockInfoList.push_back(BlockInfo(track, angle + (angleOffset * skewVal), block));
+    }
+    tracksBeginEnd[track] = make_pair(pblock, block);
+    
+    // BUG FIX 3: maxBlock should be the *last* block created,
+    // not the *starting* block of the last track.
+    maxBlock = block; 
+
+    // Adjust angles
+    for (auto& pair : blockToAngleMap) {
+        pair.second = fmod(pair.second + 180, 360);
+    }
+}
+
+void Disk::InitTables() {
+    useTables = false;
+    tableBytes = 0;
+    if (tableLimit <= 0) {
+        tableStatus = "off";
+        return;
+    }
+    tableTracks = tracks.size();
+    size_t blocks = maxBlock + 1;
+    tableBytes = tableTracks * (sizeof(double) * (tableTracks + 1) + sizeof(int)) +
+                 blocks * (sizeof(int) + 360 * sizeof(double));
+    if (tableBytes > (size_t)tableLimit * 1024) {
+        tableStatus = "over limit";
+        return;
+    }
+    if (rotateSpeed != floor(rotateSpeed)) {
+        tableStatus = "fractional rotation";
+        return;
+    }
+
+    for (int from = 0; from < tableTracks; from++) {
+        tableCenter.push_back(tracks[from] - (trackWidth / 2.0));
+        tableTrackLast.push_back(tracksBeginEnd[from].second);
+        for (int to = 0; to < tableTracks; to++) {
+            double seek = SeekTime(abs((tracks[to] - (trackWidth / 2.0)) - (tracks[from] - (trackWidth / 2.0))), false);
+            if (seek != floor(seek)) {
+                tableStatus = "fractional seek";
+                tableCenter.clear();
+                tableTrackLast.clear();
+                seekTable.clear();
+                return;
+            }
+            seekTable.push_back(seek);
+        }
+    }
+
+    // Same arithmetic as EstimateAccessFrom, for each whole arrival angle
+    for (int block = 0; block <= maxBlock; block++) {
+        int track = blockToTrackMap[block];
+        int angleOffset = blockAngleOffset[track];
+        tableTrack.push_back(track);
+        for (int arrival = 0; arrival < 360; arrival++) {
+            double rotDist = (blockToAngleMap[block] - angleOffset) - arrival;
+            while (rotDist < 0.0) rotDist += 360.0;
+            rotDist = fmod(rotDist, 360.0);
+            rotTable.push_back(rotDist / rotateSpeed);
+        }
+    }
+    useTables = true;
+    tableStatus = "on";
+}
+
+vector<Request> Disk::MakeRequests(const string& addr, const string& addrDesc) {
+    if (addr == "-1") {
+        vector<string> desc = Split(addrDesc, ',');
+        if (desc.size() != 3 && desc.size() != 4) {
+            PrintAddrDescMessage(addrDesc);
+            return vector<Request>();
+        }
+
+        int numRequests = stoi(desc[0]);
+        int maxRequest = stoi(desc[1]);
+        int minRequest = stoi(desc[2]);
+        int writePercent = (desc.size() == 4) ? stoi(desc[3]) : 0;
+
+        if (maxRequest == -1) {
+            // This now uses the corrected maxBlock value
+            maxRequest = maxBlock;
+        }
+
+        vector<string> lengths = Split(lengthDesc, ',');
+        if (lengths.size() != 2 || stoi(lengths[0]) < 1 || stoi(lengths[1]) < stoi(lengths[0])) {
+            cerr << "Length description (" << lengthDesc << ") must be minLength,maxLength in blocks" << endl;
+            exit(1);
+        }
+        int minLength = stoi(lengths[0]);
+        int maxLength = stoi(lengths[1]);
+
+        // Skewed generators have their own engine, seeded from rand() so
+        // that -s still picks the workload
+        if (dist != "uniform") {
+            workloadRng.seed(rand());
+        }
+        unique_ptr<AddressGenerator> generator = MakeGenerator(dist, minRequest, maxRequest);
+
+        vector<Request> tmpList;
+        for (int i = 0; i < numRequests; i++) {
+            Request req(generator->Next(), i);
+            // Only draw the op and length when asked to, so read-only
+            // single-block runs keep the same sequence
+            if (writePercent > 0) {
+                req.write = (rand() % 100) < writePercent;
+            }
+            req.length = minLength;
+            if (maxLength > minLength) {
+                req.length += rand() % (maxLength - minLength + 1);
+            }
+            req.length = min(req.length, maxBlock - req.block + 1);
+            generator->Issued(req.block, req.length);
+            req.stream = i % streams.size();
+            tmpList.push_back(req);
+        }
+        return tmpList;
+    } else {
+        vector<string> addrList = Split(addr, ',');
+        vector<Request> result;
+        for (const string& s : addrList) {
+            Request req = ParseRequest(s);
+            req.index = result.size();
+            result.push_back(req);
+        }
+        return result;
+    }
+}
+
+// Build the generator for a distribution spec: uniform, zipf:theta,
+// hotspot:accessPercent:spacePercent, seq:count, or a mixture of these
+// written as weight*spec+weight*spec...
+unique_ptr<AddressGenerator> Disk::MakeGenerator(const string& spec, int minBlock, int maxBlock) {
+    vector<string> parts = Split(spec, '+');
+    if (parts.size() > 1 || spec.find('*') != string::npos) {
+        vector<unique_ptr<AddressGenerator>> generators;
+        vector<double> weights;
+        for (const string& part : parts) {
+            size_t star = part.find('*');
+            if (star == string::npos || stod(part.substr(0, star)) <= 0) {
+                cerr << "Mixture component (" << part << ") must be weight*distribution with a positive weight" << endl;
+                exit(1);
+            }
+            weights.push_back(stod(part.substr(0, star)));
+            generators.push_back(MakeGenerator(part.substr(star + 1), minBlock, maxBlock));
+        }
+        return unique_ptr<AddressGenerator>(new MixtureGenerator(move(generators), weights, workloadRng));
+    }
+
+    vector<string> args = Split(spec, ':');
+    if (args[0] == "uniform" && args.size() == 1) {
+        return unique_ptr<AddressGenerator>(new UniformGenerator(minBlock, maxBlock));
+    }
+    if (args[0] == "zipf" && args.size() == 2 && stod(args[1]) >= 0) {
+        return unique_ptr<AddressGenerator>(new ZipfGenerator(minBlock, maxBlock, stod(args[1]), workloadRng));
+    }
+    if (args[0] == "hotspot" && args.size() == 3 && stod(args[1]) >= 0 && stod(args[1]) <= 100 &&
+        stod(args[2]) > 0 && stod(args[2]) <= 100) {
+        return unique_ptr<AddressGenerator>(
+            new HotspotGenerator(minBlock, maxBlock, stod(args[1]), stod(args[2]), workloadRng));
+    }
+    if (args[0] == "seq" && args.size() == 2 && stoi(args[1]) > 0) {
+        return unique_ptr<AddressGenerator>(new SequentialGenerator(minBlock, maxBlock, stoi(args[1]), workloadRng));
+    }
+    cerr << "Distribution (" << spec << ") must be uniform, zipf:theta, hotspot:accessPercent:spacePercent," << endl;
+    cerr << "seq:count, or a mixture such as 3*zipf:0.9+1*seq:2" << endl;
+    exit(1);
+}
+
+// A request is a block number, optionally followed by '+' and a length in
+// blocks, 'r' (read, the default) or 'w' (write), and '@' and a stream
+// number, e.g. "12+4w@1"
+Request Disk::ParseRequest(const string& token) {
+    size_t pos = 0;
+    Request req(stoi(token, &pos), -1);
+    while (pos < token.size()) {
+        if (token[pos] == '+' && pos + 1 < token.size() && isdigit(token[pos + 1])) {
+            size_t len = 0;
+            req.length = stoi(token.substr(pos + 1), &len);
+            pos += 1 + len;
+        } else if (token[pos] == 'w') {
+            req.write = true;
+            pos++;
+        } else if (token[pos] == 'r') {
+            req.write = false;
+            pos++;
+        } else if (token[pos] == '@' && pos + 1 < token.size() && isdigit(token[pos + 1])) {
+            size_t len = 0;
+            req.stream = stoi(token.substr(pos + 1), &len);
+            pos += 1 + len;
+        } else {
+            cerr << "Bad request (" << token << "): expected a block number optionally followed by +length, r or w, and @stream" << endl;
+            exit(1);
+        }
+    }
+    if (req.block < 0 || req.length < 1 || req.block + req.length - 1 > maxBlock) {
+        cerr << "Request (" << token << ") does not fit on the disk (blocks 0 to " << maxBlock << ")" << endl;
+        exit(1);
+    }
+    // Streams without a weight of their own get weight 1
+    while (req.stream >= (int)streams.size()) {
+        streams.push_back(StreamInfo(1));
+    }
+    return req;
+}
+
+void Disk::PrintRequests(const string& label, const vector<Request>& rList) {
+    cout << label << " ";
+    for (size_t i = 0; i < rList.size(); i++) {
+        cout << rList[i].block;
+        if (rList[i].length > 1) cout << "+" << rList[i].length;
+        if (rList[i].write) cout << "w";
+        if (streams.size() > 1) cout << "@" << rList[i].stream;
+        if (i < rList.size() - 1) cout << ",";
+    }
+    cout << endl << endl;
+}
+
+void Disk::PrintAddrDescMessage(const string& value) {
+    cerr << "Bad address description (" << value << ")" << endl;
+    cerr << "The address description must be a comma-separated list of length three, without spaces." << endl;
+    cerr << "For example, \"10,100,0\" would indicate that 10 addresses should be generated, with" << endl;
+    cerr << "100 as the maximum value, and 0 as the minimum. A max of -1 means just use the highest" << endl;
+    cerr << "possible value as the max address to generate. An optional fourth value gives the" << endl;
+    cerr << "percentage of requests that are writes (e.g. \"10,-1,0,30\")." << endl;
+    exit(1);
+}
+
+void Disk::InitDeadline() {
+    vector<string> desc = Split(deadline, ',');
+    if (desc.size() != 4) {
+        cerr << "Deadline parameters must be readExpire,writeExpire,fifoBatch,writesStarved (got " << deadline << ")" << endl;
+        exit(1);
+    }
+    readExpire = stod(desc[0]);
+    writeExpire = stod(desc[1]);
+    fifoBatch = stoi(desc[2]);
+    writesStarved = stoi(desc[3]);
+    if (fifoBatch < 1 || writesStarved < 0) {
+        cerr << "Deadline fifoBatch must be positive and writesStarved non-negative" << endl;
+        exit(1);
+    }
+
+    deadlineDir = -1;
+    deadlineNext = -1;
+    deadlineBatch = 0;
+    deadlineStarved = 0;
+    deadlineMissed = 0;
+    deadlineExpired = 0;
+    deadlineStarvations = 0;
+}
+
+void Disk::InitStreams() {
+    vector<string> weights = Split(streamWeights, ',');
+    if (weights.empty()) {
+        cerr << "Stream weights must be a comma-separated list of positive numbers" << endl;
+        exit(1);
+    }
+    for (const string& w : weights) {
+        double weight = stod(w);
+        if (weight <= 0) {
+            cerr << "Stream weight (" << w << ") must be positive" << endl;
+            exit(1);
+        }
+        streams.push_back(StreamInfo(weight));
+    }
+    if (fairBudget < 1) {
+        cerr << "Fair queueing budget (" << fairBudget << ") must be at least one block" << endl;
+        exit(1);
+    }
+
+    fairActive = -1;
+    fairUsed = 0;
+    fairStart = 0;
+    fairVirtualTime = 0;
+}
+
+void Disk::InitKyber() {
+    vector<string> desc = Split(kyber, ',');
+    if (desc.size() != 4) {
+        cerr << "Kyber parameters must be readTarget,writeTarget,maxDepth,window (got " << kyber << ")" << endl;
+        exit(1);
+    }
+    kyberTarget[0] = stod(desc[0]);
+    kyberTarget[1] = stod(desc[1]);
+    kyberMaxDepth = stoi(desc[2]);
+    kyberWindow = stoi(desc[3]);
+    if (kyberMaxDepth < 1 || kyberWindow < 1) {
+        cerr << "Kyber maxDepth and window must be positive" << endl;
+        exit(1);
+    }
+    for (int c = 0; c < 2; c++) {
+        kyberDepth[c] = kyberMaxDepth;
+        kyberInflight[c] = 0;
+        kyberThrottled[c] = 0;
+    }
+}
+
+void Disk::InitOpt() {
+    vector<string> desc = Split(opt, ',');
+    if (desc.size() != 2 || stoi(desc[0]) < 0 || stoi(desc[0]) > 20 || stoi(desc[1]) < 1) {
+        cerr << "OPT parameters must be exactLimit,beamWidth with exactLimit at most 20 (got " << opt << ")" << endl;
+        exit(1);
+    }
+    optExact = stoi(desc[0]);
+    optBeam = stoi(desc[1]);
+    optPlanned = false;
+    optEstimate = 0;
+    optGreedy = 0;
+    optStates = 0;
+    if (policy == "OPT" && (lateAddr != "-1" || lateAddrDesc.substr(0, 2) != "0," || thinkTime >= 0 ||
+                            Split(tier, ',')[0] != "0" || trace || textTrace || serviceDepth > 0)) {
+        cerr << "OPT plans a static request list: no late requests, trace, submissions, think time or fast tier"
+             << endl;
+        exit(1);
+    }
+}
+
+void Disk::InitLookahead() {
+    vector<string> desc = Split(lookahead, ',');
+    if (desc.size() != 2 || stoi(desc[0]) < 1 || stoi(desc[1]) < 1) {
+        cerr << "Lookahead parameters must be depth,beamWidth, both positive (got " << lookahead << ")" << endl;
+        exit(1);
+    }
+    lookaheadDepth = stoi(desc[0]);
+    lookaheadBeam = stoi(desc[1]);
+    lookaheadEvaluated = 0;
+    lookaheadMemoHits = 0;
+    lookaheadChanged = 0;
+}
+
+// Calibrate ticks against a real drive. One revolution takes 360 /
+// rotateSpeed ticks, so the spindle speed fixes the length of a tick; the
+// seek speed is then chosen so that a one-track seek takes the whole number
+// of ticks nearest the given time, keeping every seek a whole number of
+// ticks as with the default speeds.
+void Disk::InitUnits() {
+    tickMicros = 0;
+    seekTicks = 0;
+    blockKiB = 0;
+    headSwitchTicks = 0;
+    switching = false;
+    if (units.empty()) {
+        return;
+    }
+    vector<string> desc = Split(units, ',');
+    if (desc.size() != 3) {
+        cerr << "Units must be rpm,seekMs,blockKiB (got " << units << ")" << endl;
+        exit(1);
+    }
+    double rpm = stod(desc[0]);
+    double seekMs = stod(desc[1]);
+    blockKiB = stod(desc[2]);
+    if (rpm <= 0 || seekMs <= 0 || blockKiB <= 0) {
+        cerr << "Units must all be positive (got " << units << ")" << endl;
+        exit(1);
+    }
+    tickMicros = 60e6 / rpm * rotateSpeed / 360.0;
+
+    int ticks = max(1, (int)round(seekMs * 1000.0 / tickMicros));
+    // Prefer the nearest tick count whose speed divides the track width
+    // exactly in floating point
+    for (int delta = 0; seekTicks == 0; delta++) {
+        if (trackWidth / (trackWidth / (ticks + delta)) == ticks + delta) {
+            seekTicks = ticks + delta;
+        } else if (ticks - delta >= 1 && trackWidth / (trackWidth / (ticks - delta)) == ticks - delta) {
+            seekTicks = ticks - delta;
+        }
+    }
+    seekSpeed = trackWidth / seekTicks;
+
+    if (!profile) {
+        return;
+    }
+    if (!profile->seekCurveMs.empty()) {
+        if (profile->seekCurveMs.size() + 1 < tracks.size()) {
+            cerr << "Seek curve for " << profile->name << " needs " << tracks.size() - 1 << " entries" << endl;
+            exit(1);
+        }
+        seekCurve.push_back(0);
+        for (double ms : profile->seekCurveMs) {
+            seekCurve.push_back(max(1.0, round(ms * 1000.0 / tickMicros)));
+        }
+        seekTicks = (int)seekCurve[1];
+    }
+    headSwitchTicks = round(profile->headSwitchMs * 1000.0 / tickMicros);
+}
+
+// Ticks for the arm to move distance pixels
+double Disk::SeekTime(double distance, bool headSwitch) const {
+    if (distance == 0) {
+        return 0;
+    }
+    if (headSwitch && headSwitchTicks > 0) {
+        return headSwitchTicks;
+    }
+    if (seekCurve.empty()) {
+        return distance / armSpeedBase;
+    }
+    double moved = distance / trackWidth;
+    size_t lower = (size_t)moved;
+    if (lower + 1 >= seekCurve.size()) {
+        return seekCurve.back();
+    }
+    return seekCurve[lower] + (moved - lower) * (seekCurve[lower + 1] - seekCurve[lower]);
+}
+
+void Disk::InitTier() {
+    vector<string> desc = Split(tier, ',');
+    if (desc.size() != 4) {
+        cerr << "Tier parameters must be capacity,hitTime,promoteTime,demoteTime (got " << tier << ")" << endl;
+        exit(1);
+    }
+    tierCapacity = stoi(desc[0]);
+    tierHitTime = stod(desc[1]);
+    tierPromoteTime = stod(desc[2]);
+    tierDemoteTime = stod(desc[3]);
+    if (tierCapacity > 0) {
+        tierSketch.Init(tierCapacity);
+    }
+    ioFromTier = false;
+    tierHits = 0;
+    tierMisses = 0;
+    tierPromoted = 0;
+    tierDemoted = 0;
+    tierRejected = 0;
+    migrateTotal = 0;
+}
+
+void Disk::SwitchState(State newState) {
+    state = newState;
+    pending[currentIndex].state = newState;
+}
+
+bool Disk::RadiallyCloseTo(double a1, double a2) {
+    // Handle wrap-around: the shortest distance between two angle
+    double v = abs(a1 - a2);
+
+    if (v > 180.0) {
+
+        v = 360.0 - v;
+
+    }
+    // Be a bit more tolerant for float comparison
+    return v < (rotateSpeed + 0.0001);
+}
+
+bool Disk::DoneWithTransfer() {
+    int angleOffset = blockAngleOffset[armTrack];
+    double targetAngle = fmod(blockToAngleMap[segmentEnd] + angleOffset, 360);
+    COUNT(mapLookups, 1);
+    // A transfer of a whole track ends at the angle it started from, so
+    // only look for the end once most of the span has gone by
+    double span = 2.0 * angleOffset * (segmentEnd - segmentBlock + 1);
+    if ((timer - xferBegin) * rotateSpeed > span - 180.0 && RadiallyCloseTo(angle, targetAngle)) {
+        ioSeek += rotBegin - seekBegin;
+        ioRot += xferBegin - rotBegin;
+        ioXfer += timer - xferBegin;
+
+        // Switch to the next track and carry on with the rest of the I/O
+        const Request& io = requestQueue[currentIndex];
+        if (segmentEnd < io.block + io.length - 1) {
+            StartSegment(segmentEnd + 1);
+            switching = true;
+            PlanSeek(blockToTrackMap[segmentBlock]);
+            switching = false;
+            return false;
+        }
+
+        MarkDone();
+        return true;
+    }
+    return false;
+}
+
+void Disk::MarkDone() {
+    SwitchState(STATE_DONE);
+    requestCount++;
+    for (int merged = mergedNext[currentIndex]; merged >= 0; merged = mergedNext[merged]) {
+        pending[merged].state = STATE_DONE;
+        requestCount++;
+    }
+}
+
+bool Disk::DoneWithRotation() {
+    int angleOffset = blockAngleOffset[armTrack];
+    double targetAngle = fmod(blockToAngleMap[segmentBlock] - angleOffset, 360);
+    COUNT(mapLookups, 1);
+    // Ensure targetAngle is positive (fmod can return negative values)
+
+    if (targetAngle < 0) targetAngle += 360.0;
+    if (RadiallyCloseTo(angle, targetAngle)) {
+        SwitchState(STATE_XFER);
+        return true;
+    }
+    return false;
+}
+
+void Disk::PlanSeek(int track) {
+    seekBegin = timer;
+    SwitchState(STATE_SEEK);
+    if (track == armTrack) {
+        rotBegin = timer;
+        SwitchState(STATE_ROTATE);
+        return;
+    }
+    armTarget = track;
+    armTargetX1 = tracks[track] - (trackWidth / 2.0);
+    // A profile's seek curve sets the speed for each seek, so that the arm
+    // arrives in that seek's time
+    double speed = armSpeedBase;
+    if (!seekCurve.empty() || headSwitchTicks > 0) {
+        double distance = abs(armTargetX1 - armX1);
+        speed = distance / SeekTime(distance, switching);
+    }
+    // Inner tracks sit at smaller X, so move toward the target position
+    if (armTargetX1 >= armX1) {
+        armSpeed = speed;
+    } else {
+        armSpeed = -speed;
+    }
+}
+
+void Disk::StartSegment(int block) {
+    const Request& io = requestQueue[currentIndex];
+    segmentBlock = block;
+    segmentEnd = min(io.block + io.length - 1, tracksBeginEnd[blockToTrackMap[block]].second);
+    COUNT(mapLookups, 2);
+}
+
+bool Disk::DoneWithSeek() {
+    armX1 += armSpeed;
+    armX2 += armSpeed;
+
+    // Allow for rounding when the speed is not a power-of-two fraction, so
+    // the arm arrives after exactly distance / speed ticks
+    if ((armSpeed > 0.0 && armX1 >= armTargetX1 - 1e-6) || (armSpeed < 0.0 && armX1 <= armTargetX1 + 1e-6)) {
+        armTrack = armTarget;
+
+        // BUG FIX 2: "Snap" the arm to the exact target position upon arrival.
+        // This ensures the *next* seek calculation starts from the correct place.
+        armX1 = armTargetX1;
+        armX2 = armX1 + trackWidth;
+        
+        return true;
+    }
+    return false;
+}
+
+pair<int, int> Disk::DoSATF(const vector<Request>& rList) {
+    int minBlock = -1;
+    int minIndex = -1;
+    double minEst = -1;
+    COUNT(satfCalls, 1);
+
+    for (const Request& req : rList) {
+        if (pending[req.index].state != STATE_NULL) {
+            continue;
+        }
+
+        double totalEst = EstimateAccess(req);
+        COUNT(satfCandidates, 1);
+
+        if (minEst == -1 || totalEst < minEst) {
+            minEst = totalEst;
+            minBlock = req.block;
+            minIndex = req.index;
+        }
+    }
+
+    this->totalEst = minEst;
+    return make_pair(minBlock, minIndex);
+}
+
+// SATF over the first endIndex queued requests, read in place from the
+// packed queue
+pair<int, int> Disk::DoSATF(int endIndex) {
+    int minBlock = -1;
+    int minIndex = -1;
+    double minEst = -1;
+    COUNT(satfCalls, 1);
+
+    for (int i = 0; i < endIndex; i++) {
+        auto&& req = pending[i];
+        if (req.state != STATE_NULL) {
+            continue;
+        }
+
+        double totalEst;
+        if (tierCapacity > 0 || !TableEstimate(req.block, req.length, req.track, armX1, angle, totalEst)) {
+            totalEst = EstimateAccess(requestQueue[i]);
+        }
+        COUNT(satfCandidates, 1);
+
+        if (minEst == -1 || totalEst < minEst) {
+            minEst = totalEst;
+            minBlock = req.block;
+            minIndex = i;
+        }
+    }
+
+    this->totalEst = minEst;
+    return make_pair(minBlock, minIndex);
+}
+
+// Estimated seek, rotate and transfer time for an I/O from where the arm
+// and platter are now, including a track switch (seek to the next track
+// and rotation to its first block) each time the I/O runs off a track
+double Disk::EstimateAccess(const Request& req) {
+    if (tierCapacity > 0 && TierHit(req)) {
+        return tierHitTime * req.length;
+    }
+    return EstimateAccessFrom(req, armX1, angle);
+}
+
+// The same estimate from any arm position and platter angle. It only
+// reads the block layout, so planners may call it from several threads.
+// Single-track I/Os from a track center at a whole angle: two table loads
+// and an add. Returns false when the tables cannot answer.
+bool Disk::TableEstimate(int block, int length, int track, double armX, double startAngle,
+                         double& estimate) const {
+    if (!useTables || startAngle != floor(startAngle) || block + length - 1 > tableTrackLast[track]) {
+        return false;
+    }
+    int from = 0;
+    while (from < tableTracks && tableCenter[from] != armX) from++;
+    if (from == tableTracks) {
+        return false;
+    }
+    double seekEst = seekTable[from * tableTracks + track];
+    int arrival = ((int)startAngle + (int)(seekEst * rotateSpeed)) % 360;
+    double xferEst = (blockAngleOffset[track] * 2.0 * length) / rotateSpeed;
+    estimate = seekEst + rotTable[block * 360 + arrival] + xferEst;
+    return true;
+}
+
+double Disk::EstimateAccessFrom(const Request& req, double armX, double startAngle) const {
+    double estimate = 0;
+    if (useTables && TableEstimate(req.block, req.length, tableTrack[req.block], armX, startAngle, estimate)) {
+        return estimate;
+    }
+
+    int block = req.block;
+    int last = req.block + req.length - 1;
+    while (true) {
+        int track = blockToTrackMap.at(block);
+        int segmentLast = min(last, tracksBeginEnd.at(track).second);
+        COUNT(mapLookups, 4);
+
+        // Seek from the given arm position to the target track's center
+        double seekEst = SeekTime(abs((tracks.at(track) - (trackWidth / 2.0)) - armX), block != req.block);
+
+        // Estimate rotate time
+        int angleOffset = blockAngleOffset[track];
+        double angleAtArrival = fmod(startAngle + ((estimate + seekEst) * rotateSpeed), 360);
+
+        double rotDist = (blockToAngleMap.at(block) - angleOffset) - angleAtArrival;
+        while (rotDist < 0.0) rotDist += 360.0; // Ensure positive rotation
+        rotDist = fmod(rotDist, 360.0); // Handle full wraps
+
+        double rotEst = rotDist / rotateSpeed;
+
+        // Transfer time
+        double xferEst = (angleOffset * 2.0 * (segmentLast - block + 1)) / rotateSpeed;
+
+        estimate = estimate + seekEst + rotEst + xferEst;
+        if (segmentLast == last) {
+            return estimate;
+        }
+        armX = tracks.at(track) - (trackWidth / 2.0);
+        COUNT(mapLookups, 1);
+        block = segmentLast + 1;
+    }
+}
+
+// SATF's estimate for a request another policy has already chosen
+void Disk::EstimateChosen(int index) {
+    COUNT(satfCalls, 1);
+    COUNT(satfCandidates, 1);
+    this->totalEst = EstimateAccess(requestQueue[index]);
+}
+
+// Fill candidateList with the pending requests nearest the arm
+void Disk::DoSSTF(int endIndex) {
+    int minDist = -1; // Use -1 to handle first case
+    vector<Request>& trackList = candidateList;
+    trackList.clear();
+
+    for (int i = 0; i < endIndex; i++) {
+        auto&& req = pending[i];
+        if (req.state != STATE_NULL) {
+            continue;
+        }
+
+        int dist = abs(armTrack - req.track);
+
+        if (minDist == -1 || dist < minDist) {
+            trackList.clear();
+            trackList.push_back(requestQueue[i]);
+            minDist = dist;
+        } else if (dist == minDist) { // FIX: Compare to minDist, not character 'O'
+            trackList.push_back(requestQueue[i]);
+        }
+    }
+}
+
+// Deadline: serve requests in block order, in batches of up to fifoBatch
+// within one direction. A batch starts at the oldest request of its
+// direction when that request has expired, otherwise wherever the block
+// order continues. Reads are preferred, but writes get a turn once they
+// have been passed over writesStarved times.
+pair<int, int> Disk::DoDeadline() {
+    if (deadlineDir != -1 && deadlineBatch < fifoBatch) {
+        auto it = deadlineSorted[deadlineDir].lower_bound(make_pair(deadlineNext, -1));
+        if (it != deadlineSorted[deadlineDir].end()) {
+            pair<int, int> result = *it;
+            DeadlineDispatch(deadlineDir, result.first, result.second);
+            return result;
+        }
+    }
+
+    bool reads = !deadlineSorted[0].empty();
+    bool writes = !deadlineSorted[1].empty();
+    int dir = 1;
+    if (reads) {
+        if (writes && deadlineStarved++ >= writesStarved) {
+            dir = 1;
+        } else {
+            dir = 0;
+            if (writes) deadlineStarvations++;
+        }
+    }
+    if (dir == 1) {
+        deadlineStarved = 0;
+    }
+
+    // Drop FIFO entries already dispatched through the sorted order
+    PoolDeque<int>& fifo = deadlineFifo[dir];
+    while (pending[fifo.front()].state != STATE_NULL) {
+        fifo.pop_front();
+    }
+
+    const Request& oldest = requestQueue[fifo.front()];
+    double expire = (dir == 0) ? readExpire : writeExpire;
+    auto next = deadlineSorted[dir].end();
+    if (dir == deadlineDir) {
+        next = deadlineSorted[dir].lower_bound(make_pair(deadlineNext, -1));
+    }
+    pair<int, int> result;
+    if (oldest.arrival + expire <= timer || next == deadlineSorted[dir].end()) {
+        if (oldest.arrival + expire <= timer) deadlineExpired++;
+        result = make_pair(oldest.block, oldest.index);
+    } else {
+        result = *next;
+    }
+
+    deadlineBatch = 0;
+    DeadlineDispatch(dir, result.first, result.second);
+    return result;
+}
+
+void Disk::DeadlineDispatch(int dir, int block, int index) {
+    deadlineSorted[dir].erase(make_pair(block, index));
+    deadlineDir = dir;
+    deadlineNext = block + requestQueue[index].length;
+    deadlineBatch++;
+}
+
+// BFQ: proportional share by service budgets. The active stream keeps the
+// disk (picking its own requests with SATF) until it has been served
+// fairBudget blocks or runs dry; it is then charged the service it used,
+// scaled by its weight, and the backlogged stream with the smallest
+// virtual finish time becomes active.
+pair<int, int> Disk::DoFair() {
+    if (fairActive == -1 || fairUsed >= fairBudget || streams[fairActive].pending == 0) {
+        if (fairActive != -1) {
+            streams[fairActive].vfinish = fairStart + fairUsed / streams[fairActive].weight;
+        }
+
+        double minFinish = -1;
+        fairActive = -1;
+        for (size_t s = 0; s < streams.size(); s++) {
+            if (streams[s].pending == 0) {
+                continue;
+            }
+            double start = max(fairVirtualTime, streams[s].vfinish);
+            double finish = start + fairBudget / streams[s].weight;
+            if (minFinish == -1 || finish < minFinish) {
+                minFinish = finish;
+                fairActive = s;
+                fairStart = start;
+            }
+        }
+        fairVirtualTime = fairStart;
+        fairUsed = 0;
+    }
+
+    candidateList.clear();
+    for (size_t i = 0; i < requestQueue.size(); i++) {
+        if (pending[i].state == STATE_NULL && requestQueue[i].stream == fairActive) {
+            candidateList.push_back(requestQueue[i]);
+        }
+    }
+    pair<int, int> result = DoSATF(candidateList);
+    fairUsed += requestQueue[result.second].length;
+    return result;
+}
+
+// Kyber: admit requests of each class in arrival order while the class
+// holds fewer than kyberDepth of them, then pick among the admitted ones
+// with SATF. Tokens are returned on completion (see SchedulerFeedback).
+pair<int, int> Disk::DoKyber() {
+    for (int c = 0; c < 2; c++) {
+        while (kyberInflight[c] < kyberDepth[c] && !kyberQueue[c].empty()) {
+            kyberAdmitted.push_back(kyberQueue[c].front());
+            kyberQueue[c].pop_front();
+            kyberInflight[c]++;
+        }
+    }
+
+    candidateList.clear();
+    for (int index : kyberAdmitted) {
+        candidateList.push_back(requestQueue[index]);
+    }
+    pair<int, int> result = DoSATF(candidateList);
+    kyberAdmitted.erase(find(kyberAdmitted.begin(), kyberAdmitted.end(), result.second));
+    return result;
+}
+
+// Time at which request to (an index into optPending) would finish if
+// started at time start (relative to planning) after request from, or
+// from where the arm is now if from is -1
+double Disk::OptFinish(int from, int to, double start) const {
+    double armX = (from < 0) ? optArmX : optEndX[from];
+    double startAngle = fmod(optAngle + start * rotateSpeed, 360);
+    return start + EstimateAccessFrom(requestQueue[optPending[to]], armX, startAngle);
+}
+
+void Disk::PlanOpt() {
+    optPlanned = true;
+    for (size_t i = 0; i < requestQueue.size(); i++) {
+        if (pending[i].state == STATE_NULL) {
+            optPending.push_back(i);
+        }
+    }
+    int n = optPending.size();
+    optArmX = armX1;
+    optAngle = angle;
+    for (int index : optPending) {
+        const Request& req = requestQueue[index];
+        int lastTrack = blockToTrackMap[req.block + req.length - 1];
+        optEndX.push_back(tracks[lastTrack] - (trackWidth / 2.0));
+    }
+
+    // Greedy SATF under the same model, for comparison
+    vector<bool> served(n, false);
+    int last = -1;
+    for (int step = 0; step < n; step++) {
+        int pick = -1;
+        double pickFinish = 0;
+        for (int j = 0; j < n; j++) {
+            if (served[j]) continue;
+            double finish = OptFinish(last, j, optGreedy);
+            if (pick == -1 || finish < pickFinish) {
+                pick = j;
+                pickFinish = finish;
+            }
+        }
+        served[pick] = true;
+        last = pick;
+        optGreedy = pickFinish;
+    }
+
+    vector<int> order = (n <= optExact) ? OptExact() : OptBeam();
+    optEstimate = 0;
+    last = -1;
+    for (int j : order) {
+        optEstimate = OptFinish(last, j, optEstimate);
+        last = j;
+        optOrder.push_back(optPending[j]);
+    }
+}
+
+vector<int> Disk::OptExact() {
+    int n = optPending.size();
+    size_t full = (size_t)1 << n;
+    vector<double> best(full * n, -1);
+    vector<int8_t> parent(full * n, -1);
+    vector<vector<uint32_t>> bySize(n + 1);
+    for (uint32_t set = 1; set < full; set++) {
+        bySize[__builtin_popcount(set)].push_back(set);
+    }
+    for (int j = 0; j < n; j++) {
+        best[((size_t)1 << j) * n + j] = OptFinish(-1, j, 0);
+    }
+
+    // Each set only reads sets one smaller, so a layer can be split freely
+    for (int size = 2; size <= n; size++) {
+        const vector<uint32_t>& sets = bySize[size];
+        ParallelFor(sets.size(), [&](int, int begin, int end) {
+            for (int s = begin; s < end; s++) {
+                uint32_t set = sets[s];
+                for (int j = 0; j < n; j++) {
+                    if (!(set & (1u << j))) continue;
+                    uint32_t prev = set ^ (1u << j);
+                    double& cell = best[(size_t)set * n + j];
+                    for (int i = 0; i < n; i++) {
+                        if (!(prev & (1u << i))) continue;
+                        double finish = OptFinish(i, j, best[(size_t)prev * n + i]);
+                        if (cell < 0 || finish < cell) {
+                            cell = finish;
+                            parent[(size_t)set * n + j] = i;
+                        }
+                    }
+                }
+            }
+        });
+        optStates += sets.size() * size;
+    }
+
+    vector<int> order;
+    if (n == 0) {
+        return order;
+    }
+    uint32_t set = full - 1;
+    int j = 0;
+    for (int k = 1; k < n; k++) {
+        if (best[(size_t)set * n + k] < best[(size_t)set * n + j]) j = k;
+    }
+    while (j >= 0) {
+        order.push_back(j);
+        int i = parent[(size_t)set * n + j];
+        set ^= 1u << j;
+        j = i;
+    }
+    reverse(order.begin(), order.end());
+    return order;
+}
+
+vector<int> Disk::OptBeam() {
+    struct Node {
+        double time;
+        int last;
+        int parent;
+    };
+    struct Candidate {
+        double time;
+        int node;
+        int next;
+        bool operator<(const Candidate& o) const {
+            return time != o.time ? time < o.time : (node != o.node ? node < o.node : next < o.next);
+        }
+    };
+    int n = optPending.size();
+    vector<vector<Node>> levels(1, vector<Node>(1, Node{0, -1, -1}));
+    vector<vector<bool>> served(1, vector<bool>(n, false));
+    for (int step = 0; step < n; step++) {
+        const vector<Node>& beam = levels.back();
+        vector<vector<Candidate>> found(beam.size());
+        ParallelFor(beam.size(), [&](int, int begin, int end) {
+            for (int b = begin; b < end; b++) {
+                for (int j = 0; j < n; j++) {
+                    if (!served[b][j]) {
+                        found[b].push_back(Candidate{OptFinish(beam[b].last, j, beam[b].time), b, j});
+                    }
+                }
+            }
+        });
+        vector<Candidate> candidates;
+        for (const vector<Candidate>& part : found) {
+            candidates.insert(candidates.end(), part.begin(), part.end());
+        }
+        optStates += candidates.size();
+        size_t keep = min(candidates.size(), (size_t)optBeam);
+        partial_sort(candidates.begin(), candidates.begin() + keep, candidates.end());
+
+        vector<Node> next;
+        vector<vector<bool>> nextServed;
+        for (size_t c = 0; c < keep; c++) {
+            next.push_back(Node{candidates[c].time, candidates[c].next, candidates[c].node});
+            nextServed.push_back(served[candidates[c].node]);
+            nextServed.back()[candidates[c].next] = true;
+        }
+        levels.push_back(next);
+        served.swap(nextServed);
+    }
+
+    // The first node of the last level finishes soonest
+    vector<int> order;
+    int node = 0;
+    for (int level = n; level > 0; level--) {
+        order.push_back(levels[level][node].last);
+        node = levels[level][node].parent;
+    }
+    reverse(order.begin(), order.end());
+    return order;
+}
+
+pair<int, int> Disk::DoLookahead() {
+    int endIndex = WindowEnd();
+    vector<int>& candidates = lookaheadCandidates;
+    vector<double>& endX = lookaheadEndX;
+    candidates.clear();
+    endX.clear();
+    for (int i = 0; i < endIndex; i++) {
+        if (pending[i].state == STATE_NULL) {
+            const Request& req = requestQueue[i];
+            candidates.push_back(i);
+            endX.push_back(tracks[blockToTrackMap[req.block + req.length - 1]] - (trackWidth / 2.0));
+        }
+    }
+    int m = candidates.size();
+    int depth = min(lookaheadDepth, m);
+
+    // Searches small enough to finish in a few microseconds stay on this
+    // thread
+    bool serial = (long long)m * m * lookaheadBeam * depth < (1 << 16);
+    lookaheadFirst.assign(m, 0);
+    lookaheadBest.assign(m, 0);
+    lookaheadScratch.resize(WorkerPool::Get().Size());
+    for (LookaheadScratch& scratch : lookaheadScratch) {
+        scratch.memo.Clear(m);
+        scratch.evaluated = 0;
+        scratch.memoHits = 0;
+    }
+
+    auto search = [&](int worker, int begin, int end) {
+        LookaheadScratch& scratch = lookaheadScratch[worker];
+        // Finish times of the candidates started at start after from, as
+        // a row of access estimates. The start angle is snapped to the
+        // memo's grid first, so an estimate does not depend on which
+        // search computed it.
+        auto startRow = [&](int from, double start) {
+            int64_t step = llround(fmod(angle + start * rotateSpeed, 360) * LookaheadMemo::ANGLE_STEPS)
+                           % (360 * LookaheadMemo::ANGLE_STEPS);
+            return make_pair(scratch.memo.Row(from, step), (double)step / LookaheadMemo::ANGLE_STEPS);
+        };
+        auto finish = [&](pair<size_t, double> row, int from, int to, double start) {
+            double& access = scratch.memo.Cells()[row.first + to];
+            if (std::isnan(access)) {
+                scratch.evaluated++;
+                access = EstimateAccessFrom(requestQueue[candidates[to]], from < 0 ? armX1 : endX[from], row.second);
+            } else {
+                scratch.memoHits++;
+            }
+            return start + access;
+        };
+        vector<LookaheadPath>& beam = scratch.beam;
+        vector<LookaheadPath>& next = scratch.next;
+        vector<LookaheadStep>& steps = scratch.steps;
+        // Ties go to the lexicographically smaller sequence
+        auto before = [&](const LookaheadStep& a, const LookaheadStep& b) {
+            if (a.time != b.time) return a.time < b.time;
+            if (a.path != b.path) return beam[a.path].steps < beam[b.path].steps;
+            return a.next < b.next;
+        };
+
+        // The beams keep their full width, and their paths' step lists,
+        // from one candidate to the next; width counts the live paths
+        if (beam.size() < (size_t)lookaheadBeam) {
+            beam.resize(lookaheadBeam);
+            next.resize(lookaheadBeam);
+        }
+        for (int c = begin; c < end; c++) {
+            lookaheadFirst[c] = finish(startRow(-1, 0), -1, c, 0);
+            size_t width = 1;
+            beam[0].time = lookaheadFirst[c];
+            beam[0].steps.assign(1, c);
+            for (int level = 1; level < depth; level++) {
+                steps.clear();
+                for (int p = 0; p < (int)width; p++) {
+                    const LookaheadPath& path = beam[p];
+                    pair<size_t, double> row = startRow(path.steps.back(), path.time);
+                    for (int j = 0; j < m; j++) {
+                        if (find(path.steps.begin(), path.steps.end(), j) != path.steps.end()) continue;
+                        steps.push_back(LookaheadStep{finish(row, path.steps.back(), j, path.time), p, j});
+                    }
+                }
+                size_t keep = min(steps.size(), (size_t)lookaheadBeam);
+                partial_sort(steps.begin(), steps.begin() + keep, steps.end(), before);
+                for (size_t k = 0; k < keep; k++) {
+                    next[k].time = steps[k].time;
+                    next[k].steps = beam[steps[k].path].steps;
+                    next[k].steps.push_back(steps[k].next);
+                }
+                beam.swap(next);
+                width = keep;
+            }
+            lookaheadBest[c] = beam.front().time;
+        }
+    };
+    if (serial) {
+        search(0, 0, m);
+    } else {
+        ParallelFor(m, search);
+    }
+
+    int greedy = 0;
+    int pick = 0;
+    for (int c = 1; c < m; c++) {
+        if (lookaheadFirst[c] < lookaheadFirst[greedy]) greedy = c;
+        if (lookaheadBest[c] < lookaheadBest[pick]) pick = c;
+    }
+    for (const LookaheadScratch& scratch : lookaheadScratch) {
+        lookaheadEvaluated += scratch.evaluated;
+        lookaheadMemoHits += scratch.memoHits;
+    }
+    if (lookaheadBest[pick] == lookaheadBest[greedy]) {
+        pick = greedy;
+    }
+    if (pick != greedy) {
+        lookaheadChanged++;
+    }
+    return make_pair(requestQueue[candidates[pick]].block, candidates[pick]);
+}
+
+pair<int, int> Disk::DoOpt() {
+    if (!optPlanned) {
+        PlanOpt();
+    }
+    while (pending[optOrder.front()].state != STATE_NULL) {
+        optOrder.pop_front();
+    }
+    int index = optOrder.front();
+    optOrder.pop_front();
+    return make_pair(requestQueue[index].block, index);
+}
+
+// Completion feedback from the stats layer into the schedulers
+void Disk::SchedulerFeedback(const Request& req, double latency) {
+    int c = req.write ? 1 : 0;
+
+    if (policy == "DEADLINE") {
+        double expire = req.write ? writeExpire : readExpire;
+        if (latency > expire) {
+            deadlineMissed++;
+        }
+    } else if (policy == "KYBER") {
+        // Only the request leading a merged I/O holds a token
+        if (req.index == currentIndex) {
+            kyberInflight[c]--;
+        }
+        kyberSamples[c].push_back(latency);
+        kyberLatencies[c].push_back(latency);
+        if ((int)kyberSamples[c].size() < kyberWindow) {
+            return;
+        }
+
+        // A class over its p99 target throttles the other one; once every
+        // class with samples is back under target, depths grow again
+        bool missed = Percentile(kyberSamples[c], 0.99) > kyberTarget[c];
+        kyberSamples[c].clear();
+        int other = 1 - c;
+        if (missed) {
+            if (kyberDepth[other] > 1) {
+                kyberDepth[other] = max(1, kyberDepth[other] / 2);
+                kyberThrottled[other]++;
+            }
+        } else if (Percentile(kyberSamples[other], 0.99) <= kyberTarget[other]) {
+            for (int k = 0; k < 2; k++) {
+                kyberDepth[k] = min(kyberMaxDepth, kyberDepth[k] + 1);
+            }
+        }
+    }
+}
+
+// Anticipate the next request of the stream that just completed if it
+// has more to issue, nothing of its own is queued, it usually comes back
+// within the anticipation window, its accesses are no further apart than
+// the best alternative, and past anticipation on it has not mostly failed
+bool Disk::ShouldAnticipate(const Request& req) {
+    const StreamInfo& stream = streams[req.stream];
+    if (anticExpire <= 0 || policy == "FIFO" || stream.future == 0 || stream.pending > 0) {
+        return false;
+    }
+    if (stream.thinkMean > anticExpire) {
+        return false;
+    }
+    if (stream.anticMisses >= 4 && stream.anticHits * 2 < stream.anticMisses) {
+        return false;
+    }
+    int nearest = -1;
+    for (size_t i = 0; i < requestQueue.size(); i++) {
+        if (pending[i].state == STATE_NULL) {
+            int dist = abs(requestQueue[i].block - req.block);
+            if (nearest == -1 || dist < nearest) {
+                nearest = dist;
+            }
+        }
+    }
+    return nearest == -1 || stream.seekMean <= nearest;
+}
+
+// Called each idle tick while anticipating
+void Disk::Anticipate() {
+    StreamInfo& stream = streams[anticStream];
+    if (stream.pending > 0) {
+        for (size_t i = 0; i < requestQueue.size(); i++) {
+            if (pending[i].state != STATE_NULL || requestQueue[i].stream != anticStream) {
+                continue;
+            }
+            const Request& req = requestQueue[i];
+            anticHits++;
+            stream.anticHits++;
+            anticStream = -1;
+            Unqueue(req.index);
+            if (policy == "KYBER") {
+                kyberInflight[req.write ? 1 : 0]++;
+            } else if (policy == "BFQ" && req.stream == fairActive) {
+                fairUsed += req.length;
+            }
+            StartIO(req.block, req.index);
+            return;
+        }
+    }
+    if (timer >= anticDeadline) {
+        anticTimeouts++;
+        stream.anticMisses++;
+        anticStream = -1;
+        GetNextIO();
+    }
+}
+
+// Remove a request from the policy's own queues (when it is dispatched
+// outside the policy, or merged into another), returning any token it held
+void Disk::Unqueue(int index) {
+    const Request& req = requestQueue[index];
+    int c = req.write ? 1 : 0;
+    if (policy == "DEADLINE") {
+        deadlineSorted[c].erase(make_pair(req.block, index));
+    } else if (policy == "KYBER") {
+        auto admitted = find(kyberAdmitted.begin(), kyberAdmitted.end(), index);
+        if (admitted != kyberAdmitted.end()) {
+            kyberAdmitted.erase(admitted);
+            kyberInflight[c]--;
+        } else {
+            auto queued = find(kyberQueue[c].begin(), kyberQueue[c].end(), index);
+            if (queued != kyberQueue[c].end()) {
+                kyberQueue[c].erase(queued);
+            }
+        }
+    }
+}
+
+void Disk::ReleaseArrivals() {
+    ReleaseTrace();
+    DrainSubmissions();
+    while (!futureRequests.empty() && futureRequests.begin()->first <= timer) {
+        const Request& req = futureRequests.begin()->second;
+        StreamInfo& stream = streams[req.stream];
+        stream.future--;
+        if (stream.completed > 0 && stream.pending == 0) {
+            stream.thinkMean = 0.875 * stream.thinkMean + 0.125 * (timer - stream.lastDone);
+        }
+        AddRequest(req);
+        futureRequests.erase(futureRequests.begin());
+    }
+}
+
+// Queue the trace records that have arrived by now, straight from the
+// mapped file
+void Disk::ReleaseTrace() {
+    if (arrivalRing) {
+        while (!arrivalsDone) {
+            if (!arrivalHeld) {
+                arrivalRing->Pop(nextArrival);
+                arrivalHeld = true;
+                arrivalsDone = nextArrival.length == 0;
+                continue;
+            }
+            if (nextArrival.arrival > timer) {
+                break;
+            }
+            if (trace) {
+                QueueTraceRecord(nextArrival);
+            } else {
+                QueueTextRecord(nextArrival);
+            }
+            traceNext++;
+            arrivalHeld = false;
+        }
+        return;
+    }
+    if (trace) {
+        const TraceReader& records = *trace;
+        while (traceNext < records.Size() && records[traceNext].arrival <= timer) {
+            QueueTraceRecord(records[traceNext]);
+            traceNext++;
+        }
+    }
+
+    // A text trace's size is only known at its end, so the per-request
+    // arrays grow as it arrives
+    while (textTrace) {
+        if (traceNext == textBatch.size()) {
+            traceNext = 0;
+            if (!textTrace->NextBatch(textBatch)) {
+                textTrace.reset();
+                textBatch.clear();
+            }
+            continue;
+        }
+        const TraceRecord& record = textBatch[traceNext];
+        if (record.arrival > timer) {
+            break;
+        }
+        QueueTextRecord(record);
+        traceNext++;
+    }
+}
+
+// A text trace's records are only checked as they arrive
+void Disk::QueueTextRecord(const TraceRecord& record) {
+    if ((int)(record.block + record.length - 1) > maxBlock) {
+        cerr << "Trace reaches block " << record.block + record.length - 1
+             << ", past the end of the disk (" << maxBlock << ")" << endl;
+        exit(1);
+    }
+    AddStreams(record.stream);
+    QueueTraceRecord(record);
+}
+
+// Make room for a stream first named once the run has started. Every
+// per-stream array grows with streams, since completions index them all.
+void Disk::AddStreams(int stream) {
+    while (stream >= (int)streams.size()) {
+        streams.push_back(StreamInfo(1));
+    }
+    streamScript.resize(streams.size(), PoolDeque<Request>(&arena));
+}
+
+bool Disk::TrySubmit(int block, int length, bool write, int stream, IoCallback done) {
+    if (!submissions) {
+        cerr << "Submit needs a disk in service mode" << endl;
+        exit(1);
+    }
+    if (block < 0 || length < 1 || length > UINT16_MAX || block + length - 1 > maxBlock ||
+        stream < 0 || stream > UINT8_MAX) {
+        cerr << "Submitted request (" << block << "+" << length << "@" << stream
+             << ") does not fit on the disk (blocks 0 to " << maxBlock << ")" << endl;
+        exit(1);
+    }
+    // Reserve a place in the device first; the queue has one cell per
+    // place, so the push that follows cannot fail
+    if (inFlight.fetch_add(1) >= serviceDepth) {
+        inFlight--;
+        submitWaits++;
+        return false;
+    }
+    Submission submission = {{0, (uint32_t)block, (uint16_t)length, (uint8_t)write, (uint8_t)stream}, move(done)};
+    while (!submissions->TryPush(submission)) {
+        this_thread::yield();
+    }
+    // Pairs with the fence in WaitForSubmission: either the disk sees this
+    // submission before it sleeps, or this sees it asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (diskAsleep) {
+        lock_guard<mutex> guard(serviceLock);
+        submitted.notify_one();
+    }
+    return true;
+}
+
+void Disk::Submit(int block, int length, bool write, int stream, IoCallback done) {
+    for (int spin = 0; !TrySubmit(block, length, write, stream, done); spin++) {
+        if (spin < SERVICE_SPINS) {
+            this_thread::yield();
+            continue;
+        }
+        unique_lock<mutex> guard(serviceLock);
+        submittersAsleep++;
+        atomic_thread_fence(memory_order_seq_cst);
+        placeFreed.wait(guard, [this] { return inFlight < serviceDepth; });
+        submittersAsleep--;
+    }
+}
+
+void Disk::Close() {
+    serviceClosed = true;
+    lock_guard<mutex> guard(serviceLock);
+    submitted.notify_one();
+}
+
+future<IoCompletion> Disk::SubmitAsync(int block, int length, bool write, int stream) {
+    shared_ptr<promise<IoCompletion>> result = make_shared<promise<IoCompletion>>();
+    Submit(block, length, write, stream, [result](const IoCompletion& done) { result->set_value(done); });
+    return result->get_future();
+}
+
+// Queue what has been submitted since the last tick
+void Disk::DrainSubmissions() {
+    if (!submissions) {
+        return;
+    }
+    Submission submission;
+    while (submissions->TryPop(submission)) {
+        const TraceRecord& record = submission.record;
+        AddStreams(record.stream);
+        Request req(record.block, 0, record.write != 0);
+        req.length = record.length;
+        req.stream = record.stream;
+        req.submitted = true;
+        req.id = latencyById.size();
+        latencyById.push_back(0);
+        if (submission.done) {
+            callbacks[req.id] = move(submission.done);
+        }
+        AddRequest(req);
+        submittedCount++;
+    }
+    peakDepth = max(peakDepth, inFlight.load());
+}
+
+// A submitted request is done: free its place and report it
+void Disk::Complete(const Request& req) {
+    inFlight--;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (submittersAsleep > 0) {
+        lock_guard<mutex> guard(serviceLock);
+        placeFreed.notify_one();
+    }
+    auto callback = callbacks.find(req.id);
+    if (callback == callbacks.end()) {
+        return;
+    }
+    IoCompletion completion = {req.id, req.block, req.length, req.write, req.arrival, timer, {}};
+    if (completionRing) {
+        completion.due = paceStart + chrono::microseconds((long long)(timer * wallPerTick));
+        Timed timed = {completion, move(callback->second)};
+        while (!completionRing->TryPush(timed)) {
+            this_thread::yield();
+        }
+    } else {
+        callback->second(completion);
+    }
+    callbacks.erase(callback);
+}
+
+// Keep the clock from running more than a couple of milliseconds ahead of
+// wall time; the timer thread fires completions at their exact moment
+void Disk::Pace() {
+    chrono::steady_clock::time_point due = paceStart + chrono::microseconds((long long)(timer * wallPerTick));
+    if (due - chrono::steady_clock::now() > chrono::milliseconds(2)) {
+        this_thread::sleep_until(due - chrono::milliseconds(1));
+    }
+}
+
+// Timer stage: move completions into a wheel of 100 us slots and run the
+// callbacks of those due, until the end marker (no callback) and the wheel
+// is empty
+void Disk::RunTimers() {
+    const chrono::microseconds slot(100);
+    TimerWheel<Timed> wheel(4096);
+    bool ending = false;
+    Timed timed;
+    while (!ending || !wheel.Empty()) {
+        while (completionRing->TryPop(timed)) {
+            if (!timed.done) {
+                ending = true;
+                continue;
+            }
+            uint64_t due = (timed.completion.due - paceStart + slot - chrono::microseconds(1)) / slot;
+            wheel.Add(due, move(timed));
+        }
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        wheel.Advance((now - paceStart) / slot, [this, now](Timed& fired) {
+            if (now - fired.completion.due > chrono::milliseconds(1)) {
+                lateCallbacks++;
+            }
+            fired.done(fired.completion);
+        });
+        this_thread::sleep_for(slot);
+    }
+}
+
+// With nothing to do, wait for a submission rather than let the clock
+// run on; false once the service is closed and drained
+bool Disk::WaitForSubmission() {
+    for (int spin = 0; spin < SERVICE_SPINS; spin++) {
+        if (!submissions->Empty()) {
+            return true;
+        }
+        if (serviceClosed && submissions->Empty()) {
+            return false;
+        }
+        this_thread::yield();
+    }
+    unique_lock<mutex> guard(serviceLock);
+    diskAsleep = true;
+    atomic_thread_fence(memory_order_seq_cst);
+    submitted.wait(guard, [this] { return !submissions->Empty() || serviceClosed; });
+    diskAsleep = false;
+    return !submissions->Empty();
+}
+
+// Reader stage: push every trace record, then an end marker
+void Disk::ReadArrivals(shared_ptr<TraceParser> text) {
+    auto push = [this](const TraceRecord& record) {
+        while (!arrivalRing->TryPush(record)) {
+            if (arrivalStop) {
+                return false;
+            }
+            this_thread::yield();
+        }
+        return true;
+    };
+    if (text) {
+        vector<TraceRecord> batch;
+        while (text->NextBatch(batch)) {
+            for (const TraceRecord& record : batch) {
+                if (!push(record)) {
+                    return;
+                }
+            }
+        }
+    } else {
+        const TraceReader& records = *trace;
+        for (size_t i = 0; i < records.Size(); i++) {
+            if (!push(records[i])) {
+                return;
+            }
+        }
+    }
+    push(TraceRecord{0, 0, 0, 0, 0});
+}
+
+// Trace requests are numbered in arrival order, after the generated ones
+void Disk::QueueTraceRecord(const TraceRecord& record) {
+    if (latencyById.size() == INT_MAX) {
+        cerr << "Trace has more than " << INT_MAX << " requests" << endl;
+        exit(1);
+    }
+    Request req(record.block, 0, record.write != 0);
+    req.length = record.length;
+    req.stream = record.stream;
+    req.id = latencyById.size();
+    latencyById.push_back(0);
+    AddRequest(req);
+}
+
+bool Disk::ArrivalsPending() const {
+    if (submissions && !(serviceClosed && submissions->Empty())) {
+        return true;
+    }
+    if (arrivalRing) {
+        return !futureRequests.empty() || !arrivalsDone;
+    }
+    return !futureRequests.empty() || (trace && traceNext < trace->Size()) ||
+           textTrace || traceNext < textBatch.size();
+}
+
+// Merge a newly queued request with the pending I/O ending just before it
+// (back merge) and/or the one starting just after it (front merge, or a
+// coalesce of the two neighbours if the back merge already happened)
+void Disk::MergeRequest(int index) {
+    int leader = index;
+    auto prev = mergeByEnd.equal_range(requestQueue[index].block - 1);
+    for (auto it = prev.first; it != prev.second; ++it) {
+        int prevIndex = it->second;
+        if (TryMerge(prevIndex, index)) {
+            backMerges++;
+            leader = (pending[prevIndex].state == STATE_MERGED) ? index : prevIndex;
+            break;
+        }
+    }
+
+    const Request& lead = requestQueue[leader];
+    auto next = mergeByStart.equal_range(lead.block + lead.length);
+    for (auto it = next.first; it != next.second; ++it) {
+        if (TryMerge(leader, it->second)) {
+            if (leader == index) {
+                frontMerges++;
+            } else {
+                coalesced++;
+            }
+            break;
+        }
+    }
+}
+
+// Merge two pending I/Os where first ends right before second starts. The
+// earlier arrival leads the combined I/O so it keeps its place in any
+// arrival-ordered queue.
+bool Disk::TryMerge(int first, int second) {
+    Request& a = requestQueue[first];
+    Request& b = requestQueue[second];
+    if (first == second || pending[first].state != STATE_NULL || pending[second].state != STATE_NULL ||
+        a.write != b.write || a.stream != b.stream || a.length + b.length > maxMerge) {
+        return false;
+    }
+
+    int leader = first;
+    int absorbed = second;
+    if (b.arrival < a.arrival) {
+        leader = second;
+        absorbed = first;
+    }
+    MergeIndexErase(first);
+    MergeIndexErase(second);
+    Unqueue(absorbed);
+
+    Request& lead = requestQueue[leader];
+    if (policy == "DEADLINE" && deadlineSorted[lead.write ? 1 : 0].erase(make_pair(lead.block, leader))) {
+        deadlineSorted[lead.write ? 1 : 0].insert(make_pair(a.block, leader));
+    }
+    int start = a.block;
+    lead.length = a.length + b.length;
+    lead.block = start;
+    auto&& packed = pending[leader];
+    packed.block = start;
+    packed.length = lead.length;
+    packed.track = blockToTrackMap[start];
+
+    mergedNext[mergedLast[leader]] = absorbed;
+    mergedLast[leader] = mergedLast[absorbed];
+    pending[absorbed].state = STATE_MERGED;
+    streams[requestQueue[absorbed].stream].pending--;
+
+    MergeIndexInsert(leader);
+    return true;
+}
+
+void Disk::MergeIndexInsert(int index) {
+    const Request& req = requestQueue[index];
+    mergeByStart.insert(make_pair(req.block, index));
+    mergeByEnd.insert(make_pair(req.block + req.length - 1, index));
+}
+
+void Disk::MergeIndexErase(int index) {
+    const Request& req = requestQueue[index];
+    auto starts = mergeByStart.equal_range(req.block);
+    for (auto it = starts.first; it != starts.second; ++it) {
+        if (it->second == index) {
+            mergeByStart.erase(it);
+            break;
+        }
+    }
+    auto ends = mergeByEnd.equal_range(req.block + req.length - 1);
+    for (auto it = ends.first; it != ends.second; ++it) {
+        if (it->second == index) {
+            mergeByEnd.erase(it);
+            break;
+        }
+    }
+}
+
+bool Disk::TierHit(const Request& io) {
+    for (int block = io.block; block < io.block + io.length; block++) {
+        if (tierBlocks.find(block) == tierBlocks.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Record the I/O's accesses and migrate blocks into the fast tier,
+// returning how long the migration keeps the device busy
+double Disk::TierUpdate(const Request& io) {
+    double migrate = 0;
+    for (int block = io.block; block < io.block + io.length; block++) {
+        tierSketch.Increment(block);
+        auto cached = tierBlocks.find(block);
+        if (cached != tierBlocks.end()) {
+            tierLru.splice(tierLru.begin(), tierLru, cached->second.lru);
+            cached->second.dirty = cached->second.dirty || (io.write && ioFromTier);
+            continue;
+        }
+
+        if ((int)tierBlocks.size() >= tierCapacity) {
+            int victim = tierLru.back();
+            if (tierSketch.Estimate(block) <= tierSketch.Estimate(victim)) {
+                tierRejected++;
+                continue;
+            }
+            if (tierBlocks[victim].dirty) {
+                migrate += tierDemoteTime;
+                tierDemoted++;
+            }
+            tierBlocks.erase(victim);
+            tierLru.pop_back();
+        }
+        tierLru.push_front(block);
+        tierBlocks[block] = TierEntry{tierLru.begin(), false};
+        migrate += tierPromoteTime;
+        tierPromoted++;
+    }
+    return migrate;
+}
+
+void Disk::UpdateWindow() {
+    if (fairWindow == -1 && currWindow > 0 && currWindow < (int)requestQueue.size()) {
+        currWindow++;
+    }
+}
+
+int Disk::GetWindow() {
+    if (currWindow <= -1) {
+        return requestQueue.size();
+    } else {
+        if (fairWindow != -1) {
+            if (requestCount > 0 && (requestCount % fairWindow == 0)) {
+                currWindow = currWindow + fairWindow;
+            }
+            return currWindow;
+        } else {
+            return currWindow;
+        }
+    }
+}
+
+// End of the scheduling window in requestQueue. Requests merged into
+// another I/O are served with it, so they do not take up room in the
+// window, and the window always reaches at least one pending request.
+int Disk::WindowEnd() {
+    int window = GetWindow();
+    int size = requestQueue.size();
+    if (window >= size) {
+        return size;
+    }
+    int end = 0;
+    int counted = 0;
+    bool open = false;
+    for (; end < size && (counted < window || !open); end++) {
+        if (pending[end].state != STATE_MERGED) {
+            counted++;
+            open = open || pending[end].state == STATE_NULL;
+        }
+    }
+    return end;
+}
+
+void Disk::AddRequest(const Request& req) {
+    Request r = req;
+    r.index = requestQueue.size();
+    r.arrival = timer;
+    requestQueue.push_back(r);
+    pending.push_back(PackedRequest{r.block, (int16_t)r.length, (uint8_t)blockToTrackMap[r.block], STATE_NULL});
+    mergedNext.push_back(-1);
+    mergedLast.push_back(r.index);
+    streams[r.stream].pending++;
+
+    if (policy == "DEADLINE") {
+        int dir = r.write ? 1 : 0;
+        deadlineSorted[dir].insert(make_pair(r.block, r.index));
+        deadlineFifo[dir].push_back(r.index);
+    } else if (policy == "KYBER") {
+        kyberQueue[r.write ? 1 : 0].push_back(r.index);
+    }
+
+    if (maxMerge > 1) {
+        MergeIndexInsert(r.index);
+        MergeRequest(r.index);
+    }
+}
+
+void Disk::GetNextIO() {
+    TIME_PHASE(scheduleTime);
+    // Check if done, or only waiting for requests still to arrive
+    if (requestCount == (int)requestQueue.size()) {
+        if (ArrivalsPending()) {
+            state = STATE_IDLE;
+            return;
+        }
+        UpdateTime();
+        PrintStats();
+        isDone = true;
+        return;
+    }
+
+    // Apply policy
+    if (policy == "FIFO") {
+        // Skip over requests already served as part of a merged I/O
+        while (pending[fifoNext].state != STATE_NULL) {
+            fifoNext++;
+        }
+        currentBlock = requestQueue[fifoNext].block;
+        currentIndex = requestQueue[fifoNext].index;
+        EstimateChosen(fifoNext);
+    } else if (policy == "SATF" || policy == "BSATF") {
+        pair<int, int> result = DoSATF(WindowEnd());
+        currentBlock = result.first;
+        currentIndex = result.second;
+    } else if (policy == "SSTF") {
+        DoSSTF(WindowEnd());
+        pair<int, int> result = DoSATF(candidateList);
+        currentBlock = result.first;
+        currentIndex = result.second;
+    } else if (policy == "DEADLINE") {
+        pair<int, int> result = DoDeadline();
+        currentBlock = result.first;
+        currentIndex = result.second;
+        EstimateChosen(currentIndex);
+    } else if (policy == "BFQ") {
+        pair<int, int> result = DoFair();
+        currentBlock = result.first;
+        currentIndex = result.second;
+    } else if (policy == "KYBER") {
+        pair<int, int> result = DoKyber();
+        currentBlock = result.first;
+        currentIndex = result.second;
+    } else if (policy == "LSATF") {
+        pair<int, int> result = DoLookahead();
+        currentBlock = result.first;
+        currentIndex = result.second;
+        EstimateChosen(currentIndex);
+    } else if (policy == "OPT") {
+        pair<int, int> result = DoOpt();
+        currentBlock = result.first;
+        currentIndex = result.second;
+        EstimateChosen(currentIndex);
+    } else {
+        cerr << "Policy (" << policy << ") not implemented" << endl;
+        exit(1);
+    }
+
+    StartIO(currentBlock, currentIndex);
+}
+
+void Disk::StartIO(int block, int index) {
+    currentBlock = block;
+    currentIndex = index;
+
+    StreamInfo& stream = streams[requestQueue[currentIndex].stream];
+    stream.pending--;
+    if (stream.lastBlock != -1) {
+        stream.seekMean = 0.875 * stream.seekMean + 0.125 * abs(block - stream.lastBlock);
+    }
+    stream.lastBlock = block + requestQueue[index].length - 1;
+    MergeIndexErase(index);
+
+    ioBegin = timer;
+    ioSeek = 0;
+    ioRot = 0;
+    ioXfer = 0;
+    StartSegment(block);
+
+    ioFromTier = tierCapacity > 0 && TierHit(requestQueue[index]);
+    if (ioFromTier) {
+        tierHits++;
+        seekBegin = timer;
+        rotBegin = timer;
+        xferBegin = timer;
+        tierDone = timer + tierHitTime * requestQueue[index].length;
+        SwitchState(STATE_TIER);
+    } else {
+        if (tierCapacity > 0) {
+            tierMisses++;
+        }
+        // Do the seek
+        PlanSeek(blockToTrackMap[currentBlock]);
+    }
+
+    // Add late request
+    if (lateCount < (int)workload->lateRequests.size()) {
+        AddRequest(workload->lateRequests[lateCount]);
+        lateCount++;
+    }
+}
+
+void Disk::UpdateTime() {
+    // In console mode, just track the values
+}
+
+void Disk::Animate() {
+    // Increment timer
+    timer++;
+    COUNT(ticks, 1);
+
+    // Rotate disk
+    angle += rotateSpeed;
+    if (angle >= 360.0) {
+        angle -= 360.0; // Use subtraction for precision
+    }
+
+    ReleaseArrivals();
+
+    // Process current state
+    if (state == STATE_IDLE) {
+        idleTotal++;
+        if (anticStream != -1) {
+            Anticipate();
+        } else if (requestCount < (int)requestQueue.size()) {
+            GetNextIO();
+        }
+        return;
+    }
+    if (state == STATE_MIGRATE) {
+        migrateTotal++;
+        if (timer >= migrateDone) {
+            NextIO(-1);
+        }
+        return;
+    }
+    if (state == STATE_TIER) {
+        if (timer >= tierDone) {
+            ioXfer = timer - xferBegin;
+            MarkDone();
+            CompleteIO(-1);
+        }
+        return;
+    }
+    if (state == STATE_SEEK) {
+        if (DoneWithSeek()) {
+            rotBegin = timer;
+            SwitchState(STATE_ROTATE);
+        }
+    }
+    if (state == STATE_ROTATE) {
+        if (DoneWithRotation()) {
+            xferBegin = timer;
+            SwitchState(STATE_XFER);
+        }
+    }
+    if (state == STATE_XFER) {
+        if (DoneWithTransfer()) {
+            CompleteIO(currentBlock + requestQueue[currentIndex].length - 1);
+        }
     }
-    return tokens;
 }
 
-// Constructor
-Disk::Disk(const string& addr, const string& addrDesc, const string& lateAddr,
-           const string& lateAddrDesc, const string& policy, double seekSpeed,
-           double rotateSpeed, int skew, int window, bool compute, bool graphics,
-           const string& zoning)
-    : addr(addr), addrDesc(addrDesc), lateAddr(lateAddr), lateAddrDesc(lateAddrDesc),
-      policy(policy), seekSpeed(seekSpeed), rotateSpeed(rotateSpeed), skew(skew),
-      window(window), compute(compute), graphics(graphics), zoning(zoning) {
-
-    // Track info
-    trackWidth = 40;
-    tracks[0] = 140;
-    tracks[1] = tracks[0] - trackWidth;
-    tracks[2] = tracks[1] - trackWidth;
-
-    if (seekSpeed > 1 && ((int)trackWidth % (int)seekSpeed != 0)) {
-        cerr << "Seek speed (" << seekSpeed << ") must divide evenly into track width (" << trackWidth << ")" << endl;
-        exit(1);
+// Wrap up the current I/O. prevBlock is the last block that passed under
+// the head, or -1 if the next I/O cannot carry straight on from it.
+void Disk::CompleteIO(int prevBlock) {
+    DoRequestStats();
+    SwitchState(STATE_DONE);
+    UpdateWindow();
+    if (tierCapacity > 0) {
+        double migrate = TierUpdate(requestQueue[currentIndex]);
+        if (migrate > 0) {
+            migrateDone = timer + migrate;
+            state = STATE_MIGRATE;
+            return;
+        }
     }
-    
-    // Initialize block layout
-    InitBlockLayout();
-
-    // Make requests
-    this->requests = MakeRequests(addr, addrDesc);
-    this->lateRequests = MakeRequests(lateAddr, lateAddrDesc);
+    NextIO(prevBlock);
+}
 
-    // Fairness window
-    if (this->policy == "BSATF" && this->window != -1) {
-        fairWindow = this->window;
+void Disk::NextIO(int prevBlock) {
+    const Request& done = requestQueue[currentIndex];
+    if (ShouldAnticipate(done)) {
+        anticWaits++;
+        anticStream = done.stream;
+        anticDeadline = timer + anticExpire;
+        state = STATE_IDLE;
     } else {
-        fairWindow = -1;
+        GetNextIO();
     }
-
-    cout << "REQUESTS ";
-    for (size_t i = 0; i < this->requests.size(); i++) {
-        cout << this->requests[i];
-        if (i < this->requests.size() - 1) cout << ",";
+    if (prevBlock >= 0 && !isDone && (state == STATE_SEEK || state == STATE_ROTATE)) {
+        int nextBlock = currentBlock;
+        if (blockToTrackMap[prevBlock] == blockToTrackMap[nextBlock]) {
+            auto& trackRange = tracksBeginEnd[armTrack];
+            if ((prevBlock == trackRange.second && nextBlock == trackRange.first) ||
+                (prevBlock + 1 == nextBlock)) {
+                rotBegin = timer;
+                seekBegin = timer;
+                xferBegin = timer;
+                SwitchState(STATE_XFER);
+            }
+        }
     }
-    cout << endl << endl;
+}
 
-    if (!this->lateRequests.empty()) {
-        cout << "LATE REQUESTS ";
-        for (size_t i = 0; i < this->lateRequests.size(); i++) {
-            cout << this->lateRequests[i];
-            if (i < this->lateRequests.size() - 1) cout << ",";
-        }
-        cout << endl << endl;
+void Disk::DoRequestStats() {
+    double seekTime = ioSeek;
+    double rotTime = ioRot;
+    double xferTime = ioXfer;
+    double totalTime = timer - ioBegin;
+
+    // Nothing reads the requests of the I/O before this one any more
+    for (int index = lastServed; index >= 0; index = mergedNext[index]) {
+        requestQueue.Release(index);
     }
+    lastServed = currentIndex;
 
-    if (!this->compute) {
-        cout << endl;
-        cout << "For the requests above, compute the seek, rotate, and transfer times." << endl;
-        cout << "Use -c to see the answers." << endl;
+    const Request& io = requestQueue[currentIndex];
+    if (compute && outputRing) {
+        IoLine line = {currentBlock, (int)seekTime, (int)rotTime, (int)xferTime, (int)totalTime,
+                       io.length, ioFromTier};
+        while (!outputRing->TryPush(line)) {
+            this_thread::yield();
+        }
+    } else if (compute) {
+        cout << "Block: " << setw(3) << currentBlock
+             << "  Seek:" << setw(3) << (int)seekTime
+             << "  Rotate:" << setw(3) << (int)rotTime
+             << "  Transfer:" << setw(3) << (int)xferTime
+             << "  Total:" << setw(4) << (int)totalTime;
+        if (io.length > 1) {
+            cout << "  Length:" << setw(3) << io.length;
+        }
+        if (ioFromTier) {
+            cout << "  Hit";
+        }
         cout << endl;
     }
 
+    seekTotal += seekTime;
+    rotTotal += rotTime;
+    xferTotal += xferTime;
 
-    // Arm initialization
-    armTrack = 0;
-    armSpeedBase = seekSpeed;
-    armSpeed = seekSpeed;
-    
-    // BUG FIX 1: The arm's X position must be initialized to the
-    // center of the starting track (Track 0), not 0.
-    armX1 = tracks[armTrack] - (trackWidth / 2.0);
-    armX2 = armX1 + trackWidth;
-
+    streams[io.stream].busy += totalTime;
 
-    // Request queue initialization
-    requestCount = 0;
-    for (size_t i = 0; i < this->requests.size(); i++) {
-        requestQueue.push_back(Request(this->requests[i], i));
-        requestState.push_back(STATE_NULL);
+    // Account every request served by this I/O: the leader, then the
+    // requests merged into it
+    int mergedBlocks = 0;
+    for (int index = mergedNext[currentIndex]; index >= 0; index = mergedNext[index]) {
+        mergedBlocks += requestQueue[index].length;
     }
+    for (int index = currentIndex; index >= 0; index = mergedNext[index]) {
+        const Request& req = requestQueue[index];
+        StreamInfo& stream = streams[req.stream];
+        double latency = timer - req.arrival;
+        latencyById[req.id] = latency;
+        if (req.submitted) {
+            Complete(req);
+        }
+        stream.completed++;
+        stream.blocks += (index == currentIndex) ? req.length - mergedBlocks : req.length;
+        stream.latencyTotal += latency;
+        stream.latencyMax = max(stream.latencyMax, latency);
+        stream.lastDone = timer;
 
-    // Scheduling window
-    currWindow = this->window;
-
-    // Initial state
-    currentIndex = -1;
-    currentBlock = -1;
-    state = STATE_NULL;
-
-    // Angle and timer
-    angle = 0.0;
-    timer = 0;
-
-    // Stats
-    seekTotal = 0.0;
-    rotTotal = 0.0;
-    xferTotal = 0.0;
-
-    // Late requests
-    lateCount = 0;
-
-    // Control
-    isDone = false;
-}
+        SchedulerFeedback(req, latency);
 
-void Disk::InitBlockLayout() {
-    vector<string> zones = Split(zoning, ',');
-    if (zones.size() != 3) {
-        cerr << "Zoning must have exactly 3 values" << endl;
-        exit(1);
+        // Closed-loop streams issue their next request after thinking
+        if (thinkTime >= 0 && !streamScript[req.stream].empty()) {
+            futureRequests.insert(make_pair(timer + thinkTime, streamScript[req.stream].front()));
+            streamScript[req.stream].pop_front();
+        }
     }
+}
 
-    for (size_t i = 0; i < zones.size(); i++) {
-        cout << "z " << i << " " << zones[i] << endl;
-        blockAngleOffset.push_back(stoi(zones[i]) / 2);
+// Writer stage: format per-I/O lines until the end marker
+void Disk::WriteOutput() {
+    IoLine line;
+    while (true) {
+        outputRing->Pop(line);
+        if (line.block < 0) {
+            return;
+        }
+        cout << "Block: " << setw(3) << line.block
+             << "  Seek:" << setw(3) << line.seek
+             << "  Rotate:" << setw(3) << line.rotate
+             << "  Transfer:" << setw(3) << line.transfer
+             << "  Total:" << setw(4) << line.total;
+        if (line.length > 1) {
+            cout << "  Length:" << setw(3) << line.length;
+        }
+        if (line.hit) {
+            cout << "  Hit";
+        }
+        cout << '\n';
     }
+}
 
-    // Outer track (track 0)
-    int track = 0;
-    int angleOffset = 2 * blockAngleOffset[track];
-    int block = 0;
-    for (int angle = 0; angle < 360; angle += angleOffset) {
-        block = angle / angleOffset;
-        cout << track << " " << angleOffset << " " << block << endl;
-        blockToTrackMap[block] = track;
-        blockToAngleMap[block] = angle;
-        blockInfoList.push_back(BlockInfo(track, angle, block));
+// Wait for the writer to print every line queued so far, and stop it
+void Disk::FinishOutput() {
+    if (!outputRing) {
+        return;
     }
-    tracksBeginEnd[track] = make_pair(0, block);
-    int pblock = block + 1;
-
-    // Middle track (track 1)
-    track = 1;
-    int skewVal = this->skew;
-    angleOffset = 2 * blockAngleOffset[track];
-    for (int angle = 0; angle < 360; angle += angleOffset) {
-        block = (angle / angleOffset) + pblock;
-        cout << track << " " << skewVal << " " << angleOffset << " " << block << endl;
-        blockToTrackMap[block] = track;
-        blockToAngleMap[block] = angle + (angleOffset * skewVal);
-        blockInfoList.push_back(BlockInfo(track, angle + (angleOffset * skewVal), block));
+    IoLine end = {-1, 0, 0, 0, 0, 0, false};
+    while (!outputRing->TryPush(end)) {
+        this_thread::yield();
     }
-    tracksBeginEnd[track] = make_pair(pblock, block);
-    pblock = block + 1;
+    outputThread.join();
+    outputRing.reset();
+    cout << flush;
+}
 
-    // Inner track (track 2)
-    track = 2;
-    skewVal = 2 * this->skew;
-    angleOffset = 2 * blockAngleOffset[track];
-    for (int angle = 0; angle < 360; angle += angleOffset) {
-        block = (angle / angleOffset) + pblock;
-        cout << track << " " << skewVal << " " << angleOffset << " " << block << endl;
-        blockToTrackMap[block] = track;
-        blockToAngleMap[block] = angle + (angleOffset * skewVal);
-        blockInfoList.push_back(BlockInfo(track, angle + (angleOffset * skewVal), block));
+// Send the timer thread its end marker and wait for the callbacks it holds
+void Disk::FinishTimers() {
+    if (!completionRing) {
+        return;
     }
-    tracksBeginEnd[track] = make_pair(pblock, block);
-    
-    // BUG FIX 3: maxBlock should be the *last* block created,
-    // not the *starting* block of the last track.
-    maxBlock = block; 
-
-    // Adjust angles
-    for (auto& pair : blockToAngleMap) {
-        pair.second = fmod(pair.second + 180, 360);
+    Timed end = {IoCompletion(), nullptr};
+    while (!completionRing->TryPush(end)) {
+        this_thread::yield();
     }
+    timerThread.join();
+    completionRing.reset();
 }
 
-vector<int> Disk::MakeRequests(const string& addr, const string& addrDesc) {
-    if (addr == "-1") {
-        vector<string> desc = Split(addrDesc, ',');
-        if (desc.size() != 3) {
-            PrintAddrDescMessage(addrDesc);
-            return vector<int>();
+void Disk::PrintStats() {
+    FinishOutput();
+    if (wallPerTick > 0) {
+        // The paced clock may be ahead; the run ends when wall time catches up
+        this_thread::sleep_until(paceStart + chrono::microseconds((long long)(timer * wallPerTick)));
+    }
+    FinishTimers();
+    if (compute) {
+        cout << endl << "TOTALS      Seek:" << setw(3) << (int)seekTotal
+             << "  Rotate:" << setw(3) << (int)rotTotal
+             << "  Transfer:" << setw(3) << (int)xferTotal
+             << "  Total:" << setw(4) << (int)timer << endl;
+        if (tickMicros > 0) {
+            int blocks = 0;
+            for (const StreamInfo& stream : streams) {
+                blocks += stream.blocks;
+            }
+            double micros = timer * tickMicros;
+            cout << "UNITS       Tick: " << fixed << setprecision(3) << tickMicros << " us"
+                 << "  Track seek: " << setprecision(1) << seekTicks * tickMicros << " us"
+                 << "  Block: " << blockKiB << " KiB" << endl;
+            cout << "UNITS       Seek:" << setw(10) << seekTotal * tickMicros
+                 << "  Rotate:" << setw(10) << rotTotal * tickMicros
+                 << "  Transfer:" << setw(10) << xferTotal * tickMicros
+                 << "  Total:" << setw(10) << micros << " us"
+                 << "  IOPS:" << setw(8) << (micros > 0 ? requestQueue.size() * 1e6 / micros : 0)
+                 << "  MB/s:" << setw(7) << setprecision(2)
+                 << (micros > 0 ? blocks * blockKiB * 1024 / micros : 0) << endl;
+            cout.unsetf(ios::fixed);
+            cout << setprecision(6);
         }
-
-        int numRequests = stoi(desc[0]);
-        int maxRequest = stoi(desc[1]);
-        int minRequest = stoi(desc[2]);
-
-        if (maxRequest == -1) {
-            // This now uses the corrected maxBlock value
-            maxRequest = maxBlock;
+        if (policy == "DEADLINE") {
+            cout << "DEADLINE    Missed:" << setw(3) << deadlineMissed << "/" << requestQueue.size()
+                 << "  Expired:" << setw(3) << deadlineExpired
+                 << "  Starved:" << setw(3) << deadlineStarvations << endl;
         }
-
-        vector<int> tmpList;
-        for (int i = 0; i < numRequests; i++) {
-            tmpList.push_back((rand() % (maxRequest - minRequest + 1)) + minRequest);
+        if (policy == "KYBER") {
+            const char* names[2] = {"read ", "write"};
+            for (int c = 0; c < 2; c++) {
+                cout << "KYBER " << names[c]
+                     << "  Requests:" << setw(3) << kyberLatencies[c].size()
+                     << "  p99:" << setw(5) << (int)Percentile(kyberLatencies[c], 0.99)
+                     << "  Target:" << setw(5) << (int)kyberTarget[c]
+                     << "  Depth:" << setw(3) << kyberDepth[c]
+                     << "  Throttled:" << setw(3) << kyberThrottled[c] << endl;
+            }
         }
-        return tmpList;
-    } else {
-        vector<string> addrList = Split(addr, ',');
-        vector<int> result;
-        for (const string& s : addrList) {
-            result.push_back(stoi(s));
+        if (policy == "OPT") {
+            double gap = optEstimate > 0 ? 100.0 * (optGreedy - optEstimate) / optEstimate : 0;
+            cout << "OPT         Search: " << ((int)optPending.size() <= optExact ? "exact" : "beam")
+                 << "  States: " << optStates
+                 << "  Estimate:" << setw(5) << (int)optEstimate
+                 << "  SATF estimate:" << setw(5) << (int)optGreedy
+                 << "  Gap: " << fixed << setprecision(1) << gap << "%" << endl;
+            cout.unsetf(ios::fixed);
+            cout << setprecision(6);
         }
-        return result;
+        if (tableLimit > 0) {
+            cout << "TABLES      Status: " << tableStatus
+                 << "  Seek:" << setw(3) << seekTable.size()
+                 << "  Rotate:" << setw(6) << rotTable.size()
+                 << "  Memory:" << setw(5) << (tableBytes + 1023) / 1024 << " KiB" << endl;
+        }
+        if (policy == "LSATF") {
+            cout << "LOOKAHEAD   Depth:" << setw(3) << lookaheadDepth
+                 << "  Beam:" << setw(3) << lookaheadBeam
+                 << "  Estimates:" << setw(7) << lookaheadEvaluated
+                 << "  Memo hits:" << setw(7) << lookaheadMemoHits
+                 << "  Not greedy:" << setw(3) << lookaheadChanged << endl;
+        }
+        if (submissions) {
+            cout << "SERVICE     Submitted:" << setw(5) << submittedCount
+                 << "  Depth limit:" << setw(3) << serviceDepth
+                 << "  Peak depth:" << setw(3) << peakDepth
+                 << "  Full:" << setw(6) << submitWaits << endl;
+            if (wallPerTick > 0) {
+                chrono::duration<double> wall = chrono::steady_clock::now() - paceStart;
+                cout << "REALTIME    Tick: " << fixed << setprecision(3) << wallPerTick << " us"
+                     << "  Simulated: " << setprecision(1) << timer * wallPerTick / 1000 << " ms"
+                     << "  Wall: " << wall.count() * 1000 << " ms"
+                     << "  Late callbacks: " << lateCallbacks << endl;
+                cout.unsetf(ios::fixed);
+                cout << setprecision(6);
+            }
+        }
+        if (maxMerge > 1) {
+            cout << "MERGE       Back:" << setw(3) << backMerges
+                 << "  Front:" << setw(3) << frontMerges
+                 << "  Coalesced:" << setw(3) << coalesced << endl;
+        }
+        if (anticExpire > 0 || thinkTime >= 0) {
+            cout << "ANTICIPATE  Waits:" << setw(3) << anticWaits
+                 << "  Hits:" << setw(3) << anticHits
+                 << "  Timeouts:" << setw(3) << anticTimeouts
+                 << "  Idle:" << setw(4) << (int)idleTotal << endl;
+        }
+        if (tierCapacity > 0) {
+            cout << "TIER        Hits:" << setw(3) << tierHits
+                 << "  Misses:" << setw(3) << tierMisses
+                 << "  Promoted:" << setw(3) << tierPromoted
+                 << "  Demoted:" << setw(3) << tierDemoted
+                 << "  Rejected:" << setw(3) << tierRejected
+                 << "  Migrate:" << setw(4) << (int)migrateTotal << endl;
+        }
+        if (streams.size() > 1 || policy == "BFQ") {
+            PrintStreamStats(streams);
+        }
+        cout << endl;
     }
 }
 
-void Disk::PrintAddrDescMessage(const string& value) {
-    cerr << "Bad address description (" << value << ")" << endl;
-    cerr << "The address description must be a comma-separated list of length three, without spaces." << endl;
-    cerr << "For example, \"10,100,0\" would indicate that 10 addresses should be generated, with" << endl;
-    cerr << "100 as the maximum value, and 0 as the minimum. A max of -1 means just use the highest" << endl;
-    cerr << "possible value as the max address to generate." << endl;
-    exit(1);
-}
+void Disk::Go() {
+    if (sampleInterval > 0) {
+        sampleOut.open(sampleFile);
+        if (!sampleOut) {
+            cerr << "Cannot open sample file (" << sampleFile << ")" << endl;
+            exit(1);
+        }
+        sampleOut << "# time depth busy seek rotate xfer track completed" << endl;
+    }
 
-void Disk::SwitchState(State newState) {
-    state = newState;
-    requestState[currentIndex] = newState;
-}
+    if (pipeline && compute) {
+        outputRing.reset(new SpscRing<IoLine>(4096));
+        outputThread = thread(&Disk::WriteOutput, this);
+    }
 
-bool Disk::RadiallyCloseTo(double a1, double a2) {
-    // Handle wrap-around: the shortest distance between two angle
-    double v = abs(a1 - a2);
+    paceStart = chrono::steady_clock::now();
+    if (wallPerTick > 0 && submissions) {
+        completionRing.reset(new SpscRing<Timed>(max(1024, 2 * serviceDepth)));
+        timerThread = thread(&Disk::RunTimers, this);
+    }
 
-    if (v > 180.0) {
+    {
+        TIME_PHASE(runTime);
+        GetNextIO();
+        while (!isDone) {
+            // Idle with nothing queued: paced, the clock runs on as wall
+            // time does; otherwise it waits for the next submission
+            if (submissions && state == STATE_IDLE && anticStream == -1 &&
+                requestCount == (int)requestQueue.size() && futureRequests.empty()) {
+                bool open = wallPerTick > 0 ? !(serviceClosed && submissions->Empty()) : WaitForSubmission();
+                if (!open) {
+                    GetNextIO();
+                    continue;
+                }
+            }
+            State ticked = state;
+            Animate();
+            if (sampleInterval > 0) {
+                SampleTick(ticked);
+            }
+            if (wallPerTick > 0) {
+                Pace();
+            }
+        }
+    }
 
-        v = 360.0 - v;
+    FinishTimers();
 
+    if (sampleInterval > 0) {
+        if ((long long)timer % sampleInterval != 0) {
+            TakeSample();
+        }
+        FlushSamples();
+        sampleOut.close();
     }
-    // Ensure targetAngle is positive
-    if (targetAngle < 0) targetAngle += 360.0;
-    // Be a bit more tolerant for float comparison
-    return v < (rotateSpeed + 0.0001);
-}
-
-bool Disk::DoneWithTransfer() {
-    int angleOffset = blockAngleOffset[armTrack];
-    double targetAngle = fmod(blockToAngleMap[currentBlock] + angleOffset, 360);
-    if (RadiallyCloseTo(angle, targetAngle)) {
-        SwitchState(STATE_DONE);
-        requestCount++;
-        
-        return true;
+    if (arrivalThread.joinable()) {
+        arrivalThread.join();
     }
-    return false;
+#ifdef DISK_COUNTERS
+    PrintCounters();
+#endif
 }
 
-bool Disk::DoneWithRotation() {
-    int angleOffset = blockAngleOffset[armTrack];
-    double targetAngle = fmod(blockToAngleMap[currentBlock] - angleOffset, 360);
-    // Ensure targetAngle is positive (fmod can return negative values)
+shared_ptr<const Workload> Disk::MakeWorkload(const DiskConfig& config) {
+    DiskConfig layout = config;
+    layout.workloadOnly = true;
+    return Disk(layout).SharedWorkload();
+}
 
-    if (targetAngle < 0) targetAngle += 360.0;
-    if (RadiallyCloseTo(angle, targetAngle)) {
-        SwitchState(STATE_XFER);
-        return true;
+Disk::~Disk() {
+    FinishOutput();
+    FinishTimers();
+    arrivalStop = true;
+    if (arrivalThread.joinable()) {
+        arrivalThread.join();
     }
-    return false;
 }
 
-void Disk::PlanSeek(int track) {
-    seekBegin = timer;
-    SwitchState(STATE_SEEK);
-    if (track == armTrack) {
-        rotBegin = timer;
-        SwitchState(STATE_ROTATE);
-        return;
-    }
-    armTarget = track;
-    armTargetX1 = tracks[track] - (trackWidth / 2.0);
-    if (track >= armTrack) {
-        armSpeed = armSpeedBase;
-    } else {
-        armSpeed = -armSpeedBase;
+// Account one tick spent in the given state
+void Disk::SampleTick(State ticked) {
+    sampleTicks[ticked]++;
+    if ((long long)timer % sampleInterval == 0) {
+        TakeSample();
     }
 }
 
-bool Disk::DoneWithSeek() {
-    armX1 += armSpeed;
-    armX2 += armSpeed;
-
-    if ((armSpeed > 0.0 && armX1 >= armTargetX1) || (armSpeed < 0.0 && armX1 <= armTargetX1)) {
-        armTrack = armTarget;
+void Disk::TakeSample() {
+    Sample& s = sampleRing[sampleNext];
+    s.time = timer;
+    s.depth = requestQueue.size() - requestCount;
+    s.seek = sampleTicks[STATE_SEEK];
+    s.rotate = sampleTicks[STATE_ROTATE];
+    s.xfer = sampleTicks[STATE_XFER] + sampleTicks[STATE_TIER];
+    s.busy = s.seek + s.rotate + s.xfer + sampleTicks[STATE_MIGRATE];
+    s.ticks = 0;
+    for (int ticks : sampleTicks) {
+        s.ticks += ticks;
+    }
+    s.track = armTrack;
+    s.completed = requestCount - sampleCompleted;
+    sampleCompleted = requestCount;
+    fill(sampleTicks, sampleTicks + STATE_MIGRATE + 1, 0);
 
-        // BUG FIX 2: "Snap" the arm to the exact target position upon arrival.
-        // This ensures the *next* seek calculation starts from the correct place.
-        armX1 = armTargetX1;
-        armX2 = armX1 + trackWidth;
-        
-        return true;
+    if (++sampleNext == sampleRing.size()) {
+        FlushSamples();
+    }
+}
+
+void Disk::FlushSamples() {
+    sampleOut << fixed << setprecision(3);
+    for (size_t i = 0; i < sampleNext; i++) {
+        const Sample& s = sampleRing[i];
+        double ticks = max(s.ticks, 1);
+        sampleOut << (long long)s.time << " " << s.depth
+                  << " " << s.busy / ticks << " " << s.seek / ticks
+                  << " " << s.rotate / ticks << " " << s.xfer / ticks
+                  << " " << s.track << " " << s.completed << "\n";
     }
-    return false;
+    sampleNext = 0;
 }
 
-pair<int, int> Disk::DoSATF(const vector<Request>& rList) {
-    int minBlock = -1;
-    int minIndex = -1;
-    double minEst = -1;
+#ifdef DISK_COUNTERS
+void Disk::PrintCounters() {
+    double perCall = counters.satfCalls ? (double)counters.satfCandidates / counters.satfCalls : 0;
+    cerr << "COUNTERS    Ticks: " << counters.ticks
+         << "  SATF calls: " << counters.satfCalls
+         << "  Candidates: " << counters.satfCandidates
+         << " (" << fixed << setprecision(1) << perCall << "/call)"
+         << "  Map lookups: " << counters.mapLookups
+         << "  Arena slabs: " << arena.SlabCount()
+         << "  Large allocations: " << arena.LargeCount() << endl;
+    cerr << "PHASES      Setup: " << setprecision(3) << counters.setupTime * 1000 << " ms"
+         << "  Schedule: " << counters.scheduleTime * 1000 << " ms"
+         << "  Animate: " << (counters.runTime - counters.scheduleTime) * 1000 << " ms" << endl;
+    cerr.unsetf(ios::fixed);
+}
+#endif
 
-    for (const Request& req : rList) {
-        if (requestState[req.index] == STATE_DONE) {
-            continue;
-        }
+// Flash device: channels of dies of planes of erase blocks of pages. Each
+// disk block is one logical page, mapped to a physical page by a
+// page-level FTL. Writes go out of place, striped across channels, then
+// dies, then planes, skipping planes that hold all the valid pages they
+// can; when a plane runs low on free erase blocks, the block with the
+// fewest valid pages is copied forward and erased.
+// Requests are served in arrival order, each page operation waiting for
+// its die and channel, so requests on different dies overlap.
+class FlashDevice {
+public:
+    FlashDevice(const DiskConfig& config, const vector<Request>& requests,
+                const vector<Request>& lateRequests, const vector<StreamInfo>& streams,
+                int logicalPages);
 
-        int track = blockToTrackMap[req.block];
-        double angle = blockToAngleMap[req.block];
+    void Go();
 
-        // Estimate seek time
-        int dist = abs(armTrack - track);
-        
-        // This uses the arm's *current* position (armX1) vs. the target's
-        double seekEst = abs((tracks[track] - (trackWidth / 2.0)) - armX1) / armSpeedBase;
+private:
+    // Configuration
+    bool compute;
+    int thinkTime;
+    int channels, diesPerChannel, planesPerDie, blocksPerPlane, pagesPerBlock;
+    double readTime, programTime, eraseTime, xferTime;
 
-        // Estimate rotate time
-        int angleOffset = blockAngleOffset[track];
-        double angleAtArrival = fmod(this->angle + (seekEst * rotateSpeed), 360);
+    // Geometry and FTL state
+    int numPlanes;
+    int logicalPages;
+    vector<int> l2p;
+    vector<int> p2l;
+    vector<int> blockValid;
+    vector<int> blockWritten;
+    vector<int> planeValid;
+    int planeLimit;
+    vector<deque<int>> freeBlocks;
+    vector<int> activeBlock;
+    int allocCursor;
 
-        double rotDist = (angle - angleOffset) - angleAtArrival;
-        while (rotDist < 0.0) rotDist += 360.0; // Ensure positive rotation
-        rotDist = fmod(rotDist, 360.0); // Handle full wraps
-        
-        double rotEst = rotDist / rotateSpeed;
+    // Resource timelines
+    vector<double> dieFree;
+    vector<double> channelFree;
 
-        // Transfer time
-        double xferEst = (angleOffset * 2.0) / rotateSpeed;
+    // Workload
+    vector<Request> lateRequests;
+    int lateCount;
+    vector<deque<Request>> streamScript;
+    vector<StreamInfo> streams;
+    priority_queue<pair<double, int>, vector<pair<double, int>>, greater<pair<double, int>>> arrivals;
+    vector<Request> requestQueue;
 
-        double totalEst = seekEst + rotEst + xferEst;
+    // Stats
+    double waitTotal, serviceTotal, lastDone;
+    int hostReads, hostWrites, gcWrites, erases;
 
-        if (minEst == -1 || totalEst < minEst) {
-            minEst = totalEst;
-            minBlock = req.block;
-            minIndex = req.index;
+    static const int GC_THRESHOLD = 2;
+
+    int DieOf(int plane) const { return plane / planesPerDie; }
+    int ChannelOf(int plane) const { return DieOf(plane) / diesPerChannel; }
+    int PlaneOfPage(int ppn) const { return ppn / (blocksPerPlane * pagesPerBlock); }
+    int BlockOfPage(int ppn) const { return ppn / pagesPerBlock; }
+
+    void Arrive(const Request& req, double when);
+    double ReadPage(int lpn, double now, double& started);
+    double WritePage(int lpn, double now, double& started);
+    int AllocatePage(int plane);
+    double CollectGarbage(int plane, double now);
+    void PrintStats();
+};
+
+FlashDevice::FlashDevice(const DiskConfig& config, const vector<Request>& requests,
+                         const vector<Request>& lateRequests, const vector<StreamInfo>& streams,
+                         int logicalPages)
+    : compute(config.compute), thinkTime(config.thinkTime), logicalPages(logicalPages),
+      lateRequests(lateRequests) {
+    vector<string> geometry;
+    stringstream gs(config.flash);
+    string token;
+    while (getline(gs, token, ',')) geometry.push_back(token);
+    vector<string> timing;
+    stringstream ts(config.flashTiming);
+    while (getline(ts, token, ',')) timing.push_back(token);
+    if (geometry.size() != 5 || timing.size() != 4) {
+        cerr << "Flash geometry must be channels,dies,planes,blocksPerPlane,pagesPerBlock and timing read,program,erase,transfer" << endl;
+        exit(1);
+    }
+    channels = stoi(geometry[0]);
+    diesPerChannel = stoi(geometry[1]);
+    planesPerDie = stoi(geometry[2]);
+    blocksPerPlane = stoi(geometry[3]);
+    pagesPerBlock = stoi(geometry[4]);
+    readTime = stod(timing[0]);
+    programTime = stod(timing[1]);
+    eraseTime = stod(timing[2]);
+    xferTime = stod(timing[3]);
+
+    numPlanes = channels * diesPerChannel * planesPerDie;
+    int physicalPages = numPlanes * blocksPerPlane * pagesPerBlock;
+    // Each plane keeps GC_THRESHOLD free blocks plus the one being written
+    int reserved = numPlanes * (GC_THRESHOLD + 1) * pagesPerBlock;
+    if (channels < 1 || diesPerChannel < 1 || planesPerDie < 1 || pagesPerBlock < 1 ||
+        blocksPerPlane <= GC_THRESHOLD + 1 || logicalPages > physicalPages - reserved) {
+        cerr << "Flash geometry (" << config.flash << ") has " << physicalPages << " pages; it needs "
+             << logicalPages + reserved << " to hold " << logicalPages << " logical pages with GC headroom" << endl;
+        exit(1);
+    }
+
+    l2p.assign(logicalPages, -1);
+    p2l.assign(physicalPages, -1);
+    blockValid.assign(numPlanes * blocksPerPlane, 0);
+    blockWritten.assign(numPlanes * blocksPerPlane, 0);
+    // A plane at the limit always has a block with an invalid page for GC
+    planeValid.assign(numPlanes, 0);
+    planeLimit = (blocksPerPlane - GC_THRESHOLD - 1) * pagesPerBlock;
+    freeBlocks.resize(numPlanes);
+    activeBlock.assign(numPlanes, -1);
+    for (int p = 0; p < numPlanes; p++) {
+        for (int b = 0; b < blocksPerPlane; b++) {
+            freeBlocks[p].push_back(p * blocksPerPlane + b);
         }
     }
+    allocCursor = 0;
+    dieFree.assign(channels * diesPerChannel, 0);
+    channelFree.assign(channels, 0);
 
-    this->totalEst = minEst;
-    return make_pair(minBlock, minIndex);
+    for (const StreamInfo& stream : streams) {
+        this->streams.push_back(StreamInfo(stream.weight));
+    }
+    streamScript.resize(this->streams.size());
+    lateCount = 0;
+    for (const Request& req : requests) {
+        StreamInfo& stream = this->streams[req.stream];
+        if (thinkTime >= 0 && stream.pending + stream.future > 0) {
+            streamScript[req.stream].push_back(req);
+            stream.future++;
+        } else {
+            stream.pending++;
+            Arrive(req, 0);
+        }
+    }
+
+    waitTotal = 0;
+    serviceTotal = 0;
+    lastDone = 0;
+    hostReads = 0;
+    hostWrites = 0;
+    gcWrites = 0;
+    erases = 0;
 }
 
-vector<Request> Disk::DoSSTF(const vector<Request>& rList) {
-    int minDist = -1; // Use -1 to handle first case
-    vector<Request> trackList;
+void FlashDevice::Arrive(const Request& req, double when) {
+    Request r = req;
+    r.index = requestQueue.size();
+    r.arrival = when;
+    requestQueue.push_back(r);
+    arrivals.push(make_pair(when, r.index));
+}
 
-    for (const Request& req : rList) {
-        if (requestState[req.index] == STATE_DONE) {
-            continue;
-        }
+// Page read: array read on the die, then out over the channel
+double FlashDevice::ReadPage(int lpn, double now, double& started) {
+    int ppn = l2p[lpn];
+    // Never-written pages are read from where they would have been striped
+    int plane = (ppn == -1) ? lpn % numPlanes : PlaneOfPage(ppn);
+    int die = DieOf(plane);
+    int channel = ChannelOf(plane);
 
-        int track = blockToTrackMap[req.block];
-        int dist = abs(armTrack - track);
+    double start = max(now, dieFree[die]);
+    double xferStart = max(start + readTime, channelFree[channel]);
+    channelFree[channel] = xferStart + xferTime;
+    dieFree[die] = xferStart + xferTime;
+    started = min(started, start);
+    hostReads++;
+    return xferStart + xferTime;
+}
 
-        if (minDist == -1 || dist < minDist) {
-            trackList.clear();
-            trackList.push_back(req);
-            minDist = dist;
-            } else if (dist == minDist) { // FIX: Compare to minDist, not character 'O'
-            trackList.push_back(req);
-        }
+// Page write: in over the channel, then programmed out of place
+double FlashDevice::WritePage(int lpn, double now, double& started) {
+    if (l2p[lpn] != -1) {
+        blockValid[BlockOfPage(l2p[lpn])]--;
+        planeValid[PlaneOfPage(l2p[lpn])]--;
+        p2l[l2p[lpn]] = -1;
     }
 
-    return trackList;
+    // The capacity check leaves room below the limit on some plane
+    int plane;
+    do {
+        int c = allocCursor++;
+        plane = ((c % channels) * diesPerChannel + (c / channels) % diesPerChannel) * planesPerDie
+                + (c / (channels * diesPerChannel)) % planesPerDie;
+    } while (planeValid[plane] >= planeLimit);
+    int die = DieOf(plane);
+    int channel = ChannelOf(plane);
+
+    int ppn = AllocatePage(plane);
+    l2p[lpn] = ppn;
+    p2l[ppn] = lpn;
+    blockValid[BlockOfPage(ppn)]++;
+    planeValid[plane]++;
+
+    double start = max(now, max(dieFree[die], channelFree[channel]));
+    channelFree[channel] = start + xferTime;
+    dieFree[die] = start + xferTime + programTime;
+    started = min(started, start);
+    hostWrites++;
+
+    double done = dieFree[die];
+    if ((int)freeBlocks[plane].size() < GC_THRESHOLD) {
+        CollectGarbage(plane, done);
+    }
+    return done;
 }
 
-void Disk::UpdateWindow() {
-    if (fairWindow == -1 && currWindow > 0 && currWindow < (int)requestQueue.size()) {
-        currWindow++;
+int FlashDevice::AllocatePage(int plane) {
+    int& block = activeBlock[plane];
+    if (block == -1 || blockWritten[block] == pagesPerBlock) {
+        block = freeBlocks[plane].front();
+        freeBlocks[plane].pop_front();
     }
+    return block * pagesPerBlock + blockWritten[block]++;
 }
 
-int Disk::GetWindow() {
-    if (currWindow <= -1) {
-        return requestQueue.size();
-    } else {
-        if (fairWindow != -1) {
-            if (requestCount > 0 && (requestCount % fairWindow == 0)) {
-                currWindow = currWindow + fairWindow;
+// Greedy GC: copy the valid pages of the fullest-of-garbage block to the
+// plane's active block and erase it, until the plane has headroom again.
+// The die is busy for the copies and the erase.
+double FlashDevice::CollectGarbage(int plane, double now) {
+    int die = DieOf(plane);
+    double t = max(now, dieFree[die]);
+    while ((int)freeBlocks[plane].size() < GC_THRESHOLD) {
+        int victim = -1;
+        for (int b = plane * blocksPerPlane; b < (plane + 1) * blocksPerPlane; b++) {
+            if (b != activeBlock[plane] && blockWritten[b] == pagesPerBlock && blockValid[b] < pagesPerBlock &&
+                (victim == -1 || blockValid[b] < blockValid[victim])) {
+                victim = b;
             }
-            return currWindow;
-        } else {
-            return currWindow;
         }
+        if (victim == -1) {
+            cerr << "Flash plane " << plane << " has no block with an invalid page to collect" << endl;
+            exit(1);
+        }
+        for (int ppn = victim * pagesPerBlock; ppn < (victim + 1) * pagesPerBlock; ppn++) {
+            if (p2l[ppn] == -1) {
+                continue;
+            }
+            int lpn = p2l[ppn];
+            int dest = AllocatePage(plane);
+            p2l[dest] = lpn;
+            l2p[lpn] = dest;
+            blockValid[BlockOfPage(dest)]++;
+            p2l[ppn] = -1;
+            t += readTime + programTime;
+            gcWrites++;
+        }
+        blockValid[victim] = 0;
+        blockWritten[victim] = 0;
+        freeBlocks[plane].push_back(victim);
+        t += eraseTime;
+        erases++;
     }
+    dieFree[die] = t;
+    return t;
 }
 
-void Disk::AddRequest(int block) {
-    requestQueue.push_back(Request(block, requestQueue.size()));
-    requestState.push_back(STATE_NULL);
-}
+void FlashDevice::Go() {
+    while (!arrivals.empty()) {
+        double now = arrivals.top().first;
+        int index = arrivals.top().second;
+        arrivals.pop();
+        const Request req = requestQueue[index];
 
-void Disk::GetNextIO() {
-    // Check if done
-    if (requestCount == (int)requestQueue.size()) {
-        UpdateTime();
-        PrintStats();
-        isDone = true;
-        return;
-    }
+        double started = 1e300;
+        double done = now;
+        for (int lpn = req.block; lpn < req.block + req.length; lpn++) {
+            double pageDone = req.write ? WritePage(lpn, now, started) : ReadPage(lpn, now, started);
+            done = max(done, pageDone);
+        }
 
-    // Apply policy
-    if (policy == "FIFO") {
-        currentBlock = requestQueue[requestCount].block;
-        currentIndex = requestQueue[requestCount].index;
-        vector<Request> singleReq;
-        singleReq.push_back(requestQueue[requestCount]);
-        DoSATF(singleReq);
-    } else if (policy == "SATF" || policy == "BSATF") {
-        int endIndex = GetWindow();
-        if (endIndex > (int)requestQueue.size()) {
-            endIndex = requestQueue.size();
+        // Late requests come in one per dispatch, as on the disk
+        if (lateCount < (int)lateRequests.size()) {
+            Arrive(lateRequests[lateCount++], started);
         }
-        vector<Request> subQueue(requestQueue.begin(), requestQueue.begin() + endIndex);
-        pair<int, int> result = DoSATF(subQueue);
-        currentBlock = result.first;
-        currentIndex = result.second;
-    } else if (policy == "SSTF") {
-        int endIndex = GetWindow();
-        if (endIndex > (int)requestQueue.size()) {
-            endIndex = requestQueue.size();
+
+        double wait = started - now;
+        double service = done - started;
+        if (compute) {
+            cout << "Block: " << setw(3) << req.block
+                 << "  Wait:" << setw(3) << (int)wait
+                 << "  Service:" << setw(3) << (int)service
+                 << "  Total:" << setw(4) << (int)(done - now);
+            if (req.length > 1) {
+                cout << "  Length:" << setw(3) << req.length;
+            }
+            cout << endl;
         }
-        vector<Request> subQueue(requestQueue.begin(), requestQueue.begin() + endIndex);
-        vector<Request> trackList = DoSSTF(subQueue);
-        pair<int, int> result = DoSATF(trackList);
-        currentBlock = result.first;
-        currentIndex = result.second;
-    } else {
-        cerr << "Policy (" << policy << ") not implemented" << endl;
-        exit(1);
-    }
+        waitTotal += wait;
+        serviceTotal += service;
+        lastDone = max(lastDone, done);
 
-    // Do the seek
-    PlanSeek(blockToTrackMap[currentBlock]);
+        StreamInfo& stream = streams[req.stream];
+        stream.completed++;
+        stream.blocks += req.length;
+        stream.busy += service;
+        stream.latencyTotal += done - now;
+        stream.latencyMax = max(stream.latencyMax, done - now);
+        stream.lastDone = max(stream.lastDone, done);
 
-    // Add late request
-    if (!lateRequests.empty() && lateCount < (int)lateRequests.size()) {
-        AddRequest(lateRequests[lateCount]);
-        lateCount++;
+        // Closed-loop streams issue their next request after thinking
+        if (thinkTime >= 0 && !streamScript[req.stream].empty()) {
+            Arrive(streamScript[req.stream].front(), done + thinkTime);
+            streamScript[req.stream].pop_front();
+        }
     }
+    PrintStats();
 }
 
-void Disk::UpdateTime() {
-    // In console mode, just track the values
+void FlashDevice::PrintStats() {
+    if (compute) {
+        double amplification = hostWrites ? (double)(hostWrites + gcWrites) / hostWrites : 0;
+        cout << endl << "TOTALS      Wait:" << setw(3) << (int)waitTotal
+             << "  Service:" << setw(3) << (int)serviceTotal
+             << "  Total:" << setw(4) << (int)lastDone << endl;
+        cout << "FLASH       Reads:" << setw(3) << hostReads
+             << "  Writes:" << setw(3) << hostWrites
+             << "  GC writes:" << setw(3) << gcWrites
+             << "  Erases:" << setw(3) << erases
+             << "  WA: " << fixed << setprecision(2) << amplification << endl;
+        cout.unsetf(ios::fixed);
+        cout << setprecision(6);
+        if (streams.size() > 1) {
+            PrintStreamStats(streams);
+        }
+        cout << endl;
+    }
 }
 
-void Disk::Animate() {
-    // Increment timer
-    timer++;
-
-    // Rotate disk
-    angle += rotateSpeed;
-    if (angle >= 360.0) {
-        angle -= 360.0; // Use subtraction for precision
+// Convert a text trace to the binary format, parsing it in parallel
+int ConvertTrace(const string& textPath, const string& binPath) {
+    TraceParser parser(textPath);
+    ofstream out(binPath, ios::binary);
+    if (!out) {
+        cerr << "Cannot write trace file " << binPath << endl;
+        return 1;
     }
+    TraceHeader header = {{'D', 'I', 'S', 'K', 'T', 'R', 'C', '1'}, 0, 0, 0};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
 
-    // Process current state
-    if (state == STATE_SEEK) {
-        if (DoneWithSeek()) {
-            rotBegin = timer;
-            SwitchState(STATE_ROTATE);
+    vector<TraceRecord> batch;
+    while (parser.NextBatch(batch)) {
+        for (const TraceRecord& record : batch) {
+            header.lastBlock = max<uint32_t>(header.lastBlock, record.block + record.length - 1);
+            header.streams = max<uint32_t>(header.streams, record.stream + 1);
         }
+        header.count += batch.size();
+        out.write(reinterpret_cast<const char*>(batch.data()), batch.size() * sizeof(TraceRecord));
     }
-    if (state == STATE_ROTATE) {
-        if (DoneWithRotation()) {
-            xferBegin = timer;
-            SwitchState(STATE_XFER);
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!out) {
+        cerr << "Cannot write trace file " << binPath << endl;
+        return 1;
+    }
+    cout << "CONVERT     Records: " << header.count << "  Last block: " << header.lastBlock
+         << "  Streams: " << header.streams << endl;
+    return 0;
+}
+
+// Two-sided 95% Student t critical values for 1..30 degrees of freedom
+static double TCritical95(int df) {
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    return df <= 30 ? table[df - 1] : 1.960;
+}
+
+// Mean, standard deviation and 95% confidence half-width of a sample
+struct Estimate {
+    double mean;
+    double stddev;
+    double half;
+    Estimate(const vector<double>& xs) : mean(0), stddev(0), half(0) {
+        for (double x : xs) mean += x;
+        mean /= xs.size();
+        if (xs.size() > 1) {
+            for (double x : xs) stddev += (x - mean) * (x - mean);
+            stddev = sqrt(stddev / (xs.size() - 1));
+            half = TCritical95(xs.size() - 1) * stddev / sqrt(xs.size());
         }
     }
-    if (state == STATE_XFER) {
-        if (DoneWithTransfer()) {
-            DoRequestStats();
-            SwitchState(STATE_DONE);
-            UpdateWindow();
-            int prevBlock = currentBlock;
-            GetNextIO();
-            if (!isDone) {
-                int nextBlock = currentBlock;
-                if (blockToTrackMap[prevBlock] == blockToTrackMap[nextBlock]) {
-                    auto& trackRange = tracksBeginEnd[armTrack];
-                    if ((prevBlock == trackRange.second && nextBlock == trackRange.first) ||
-                        (prevBlock + 1 == nextBlock)) {
-                        rotBegin = timer;
-                        seekBegin = timer;
-                        xferBegin = timer;
-                        SwitchState(STATE_XFER);
-                    }
-                }
+};
+
+// Run the workload with seeds seed, seed+1, ... and report the spread of
+// the totals. Disks are built one at a time, since generating requests
+// uses rand(), and then simulated in parallel, a batch of one per hardware
+// thread at a time. With a precision, stop after the first batch that
+// brings every total's confidence half-width within that fraction of its
+// mean.
+int RunReplicas(DiskConfig config, int seed, int replicas, double precision) {
+    config.compute = false;
+    config.quiet = true;
+    config.sample = 0;
+
+    int batchSize = max(1u, thread::hardware_concurrency());
+    vector<double> seeks, rotates, transfers, totals;
+    bool converged = false;
+    int nextSeed = seed;
+    int lastSeed = seed;
+    while ((int)totals.size() < replicas && !converged) {
+        int count = min(batchSize, replicas - (int)totals.size());
+        vector<unique_ptr<Disk>> disks;
+        for (int i = 0; i < count; i++) {
+            srand(nextSeed);
+            disks.push_back(unique_ptr<Disk>(new Disk(config)));
+            lastSeed = nextSeed;
+            // srand(0) gives the same sequence as srand(1)
+            nextSeed = (nextSeed == 0) ? 2 : nextSeed + 1;
+        }
+        vector<thread> workers;
+        for (auto& disk : disks) {
+            workers.push_back(thread(&Disk::Go, disk.get()));
+        }
+        for (thread& worker : workers) {
+            worker.join();
+        }
+        for (auto& disk : disks) {
+            seeks.push_back(disk->SeekTotal());
+            rotates.push_back(disk->RotateTotal());
+            transfers.push_back(disk->TransferTotal());
+            totals.push_back(disk->TotalTime());
+        }
+
+        if (precision > 0 && totals.size() > 1) {
+            converged = true;
+            for (const vector<double>* xs : {&seeks, &rotates, &transfers, &totals}) {
+                Estimate e(*xs);
+                converged = converged && e.half <= precision * e.mean;
             }
         }
     }
+
+    cout << "REPLICAS    Runs: " << totals.size() << "  Seeds: " << seed << "-" << lastSeed;
+    if (precision > 0) {
+        cout << "  Precision: " << (converged ? "reached" : "not reached");
+    }
+    cout << endl;
+    const char* names[4] = {"SEEK     ", "ROTATE   ", "TRANSFER ", "TOTAL    "};
+    const vector<double>* samples[4] = {&seeks, &rotates, &transfers, &totals};
+    cout << fixed << setprecision(1);
+    for (int i = 0; i < 4; i++) {
+        Estimate e(*samples[i]);
+        cout << names[i] << "   Mean:" << setw(8) << e.mean
+             << "  Stddev:" << setw(7) << e.stddev
+             << "  95% CI: " << setw(8) << e.mean - e.half << " - " << setw(8) << e.mean + e.half << endl;
+    }
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6) << endl;
+    return 0;
 }
 
-void Disk::DoRequestStats() {
-    double seekTime = rotBegin - seekBegin;
-    double rotTime = xferBegin - rotBegin;
-    double xferTime = timer - xferBegin;
-    double totalTime = timer - seekBegin;
+// Run one workload under several policies at once, one thread each, all
+// reading the same Workload, and print their totals side by side. With
+// compute, also list each request's latency under the first policy and
+// how much the others change it.
+int RunComparison(DiskConfig config, const vector<string>& policies) {
+    config.sample = 0;
+    bool compute = config.compute;
+    config.compute = true;
+    shared_ptr<const Workload> shared = Disk::MakeWorkload(config);
 
-    if (compute) {
-        cout << "Block: " << setw(3) << currentBlock
-             << "  Seek:" << setw(3) << (int)seekTime
-             << "  Rotate:" << setw(3) << (int)rotTime
-             << "  Transfer:" << setw(3) << (int)xferTime
-             << "  Total:" << setw(4) << (int)totalTime << endl;
+    config.compute = false;
+    config.quiet = true;
+    config.workload = shared;
+    vector<unique_ptr<Disk>> disks;
+    for (const string& policy : policies) {
+        config.policy = policy;
+        disks.push_back(unique_ptr<Disk>(new Disk(config)));
+    }
+    vector<thread> workers;
+    for (auto& disk : disks) {
+        workers.push_back(thread(&Disk::Go, disk.get()));
+    }
+    for (thread& worker : workers) {
+        worker.join();
     }
 
-    seekTotal += seekTime;
-    rotTotal += rotTime;
-    xferTotal += xferTime;
-}
-
-void Disk::PrintStats() {
-    if (compute) {
-        cout << endl << "TOTALS      Seek:" << setw(3) << (int)seekTotal
-             << "  Rotate:" << setw(3) << (int)rotTotal
-             << "  Transfer:" << setw(3) << (int)xferTotal
-             << "  Total:" << setw(4) << (int)timer << endl << endl;
+    double tickMicros = disks[0]->TickMicros();
+    cout << "POLICY        Seek  Rotate  Transfer    Total  Latency avg     max";
+    if (tickMicros > 0) {
+        cout << "    Total us     IOPS";
     }
-}
+    cout << endl;
+    cout << fixed << setprecision(1);
+    for (size_t p = 0; p < policies.size(); p++) {
+        const Disk& disk = *disks[p];
+        const vector<double>& latencies = disk.Latencies();
+        double sum = 0;
+        double worst = 0;
+        for (double latency : latencies) {
+            sum += latency;
+            worst = max(worst, latency);
+        }
+        cout << left << setw(10) << policies[p] << right
+             << setw(8) << (int)disk.SeekTotal()
+             << setw(8) << (int)disk.RotateTotal()
+             << setw(10) << (int)disk.TransferTotal()
+             << setw(9) << (int)disk.TotalTime()
+             << setw(13) << (latencies.empty() ? 0 : sum / latencies.size())
+             << setw(8) << (int)worst;
+        if (tickMicros > 0) {
+            double micros = disk.TotalTime() * tickMicros;
+            cout << setw(12) << micros << setw(9) << (micros > 0 ? latencies.size() * 1e6 / micros : 0);
+        }
+        cout << endl;
+    }
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
 
-void Disk::Go() {
-    GetNextIO();
-    while (!isDone) {
-        Animate();
+    if (compute) {
+        const Workload& workload = *shared;
+        cout << endl << "Request  Block" << setw(10) << policies[0];
+        for (size_t p = 1; p < policies.size(); p++) {
+            cout << setw(10) << policies[p];
+        }
+        cout << endl;
+        const vector<double>& base = disks[0]->Latencies();
+        for (size_t id = 0; id < base.size(); id++) {
+            size_t late = id - workload.requests.size();
+            size_t traced = late - workload.lateRequests.size();
+            int block = id < workload.requests.size() ? workload.requests[id].block
+                      : late < workload.lateRequests.size() ? workload.lateRequests[late].block
+                      : (*config.trace)[traced].block;
+            cout << setw(7) << id << setw(7) << block << setw(10) << (int)base[id];
+            for (size_t p = 1; p < policies.size(); p++) {
+                int delta = (int)disks[p]->Latencies()[id] - (int)base[id];
+                cout << setw(10) << (delta > 0 ? "+" + to_string(delta) : to_string(delta));
+            }
+            cout << endl;
+        }
     }
+    cout << endl;
+    return 0;
 }
 
 // Main function
@@ -686,6 +5043,34 @@ int main(int argc, char* argv[]) {
     string lateAddr = "-1";
     string lateAddrDesc = "0,-1,0";
     bool compute = false;
+    string deadline = "500,5000,16,2";
+    string streamWeights = "1";
+    int fairBudget = 4;
+    string kyber = "1000,5000,16,16";
+    int thinkTime = -1;
+    int antic = 0;
+    int maxMerge = 1;
+    string lengthDesc = "1,1";
+    string device = "disk";
+    string flash = "2,2,1,16,4";
+    string flashTiming = "2,20,130,1";
+    string tier = "0,2,20,40";
+    string dist = "uniform";
+    int sample = 0;
+    string sampleFile = "samples.txt";
+    int replicas = 0;
+    double precision = 0;
+    string compare = "";
+    string optParams = "16,64";
+    string lookahead = "3,8";
+    int tables = 0;
+    string units = "";
+    string profileSpec = "";
+    string traceFile = "";
+    string convert = "";
+    bool pipeline = false;
+    string service = "";
+    double realtime = 0;
 
     // Parse command-line options
     struct option long_options[] = {
@@ -702,12 +5087,40 @@ int main(int argc, char* argv[]) {
         {"lateAddr",     required_argument, 0, 'l'},
         {"lateAddrDesc", required_argument, 0, 'L'},
         {"compute",      no_argument,       0, 'c'},
+        {"deadline",     required_argument, 0, 'd'},
+        {"weights",      required_argument, 0, 'W'},
+        {"fairBudget",   required_argument, 0, 'b'},
+        {"kyber",        required_argument, 0, 'K'},
+        {"thinkTime",    required_argument, 0, 'T'},
+        {"antic",        required_argument, 0, 'I'},
+        {"maxMerge",     required_argument, 0, 'm'},
+        {"lengthDesc",   required_argument, 0, 'N'},
+        {"device",       required_argument, 0, 'D'},
+        {"flash",        required_argument, 0, 'F'},
+        {"flashTiming",  required_argument, 0, 'P'},
+        {"tier",         required_argument, 0, 'C'},
+        {"dist",         required_argument, 0, 'g'},
+        {"sample",       required_argument, 0, 'e'},
+        {"sampleFile",   required_argument, 0, 'f'},
+        {"replicas",     required_argument, 0, 'r'},
+        {"precision",    required_argument, 0, 'x'},
+        {"compare",      required_argument, 0, 'y'},
+        {"opt",          required_argument, 0, 'O'},
+        {"lookahead",    required_argument, 0, 'k'},
+        {"tables",       required_argument, 0, 't'},
+        {"units",        required_argument, 0, 'u'},
+        {"profile",      required_argument, 0, 'M'},
+        {"trace",        required_argument, 0, 'E'},
+        {"convert",      required_argument, 0, 'J'},
+        {"pipeline",     no_argument,       0, 'Q'},
+        {"service",      required_argument, 0, 'V'},
+        {"realtime",     required_argument, 0, 'Z'},
         {0, 0, 0, 0}
     };
 
     int opt;
     int option_index = 0;
-    while ((opt = getopt_long(argc, argv, "s:a:A:S:R:p:w:o:z:Gl:L:c", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "s:a:A:S:R:p:w:o:z:Gl:L:cd:W:b:K:T:I:m:N:D:F:P:C:g:e:f:r:x:y:O:k:t:u:M:E:J:QV:Z:", long_options, &option_index)) != -1) {
         switch (opt) {
             case 's': seed = atoi(optarg); break;
             case 'a': addr = optarg; break;
@@ -722,12 +5135,121 @@ int main(int argc, char* argv[]) {
             case 'l': lateAddr = optarg; break;
             case 'L': lateAddrDesc = optarg; break;
             case 'c': compute = true; break;
+            case 'd': deadline = optarg; break;
+            case 'W': streamWeights = optarg; break;
+            case 'b': fairBudget = atoi(optarg); break;
+            case 'K': kyber = optarg; break;
+            case 'T': thinkTime = atoi(optarg); break;
+            case 'I': antic = atoi(optarg); break;
+            case 'm': maxMerge = atoi(optarg); break;
+            case 'N': lengthDesc = optarg; break;
+            case 'D': device = optarg; break;
+            case 'F': flash = optarg; break;
+            case 'P': flashTiming = optarg; break;
+            case 'C': tier = optarg; break;
+            case 'g': dist = optarg; break;
+            case 'e': sample = atoi(optarg); break;
+            case 'f': sampleFile = optarg; break;
+            case 'r': replicas = atoi(optarg); break;
+            case 'x': precision = atof(optarg); break;
+            case 'y': compare = optarg; break;
+            case 'O': optParams = optarg; break;
+            case 'k': lookahead = optarg; break;
+            case 't': tables = atoi(optarg); break;
+            case 'u': units = optarg; break;
+            case 'M': profileSpec = optarg; break;
+            case 'E': traceFile = optarg; break;
+            case 'J': convert = optarg; break;
+            case 'Q': pipeline = true; break;
+            case 'V': service = optarg; break;
+            case 'Z': realtime = atof(optarg); break;
             default:
                 cerr << "Usage: " << argv[0] << " [options]" << endl;
                 return 1;
         }
     }
 
+    if (!convert.empty()) {
+        vector<string> paths;
+        stringstream ss(convert);
+        string path;
+        while (getline(ss, path, ',')) {
+            paths.push_back(path);
+        }
+        if (paths.size() != 2) {
+            cerr << "Convert takes text,binary trace paths (got " << convert << ")" << endl;
+            return 1;
+        }
+        return ConvertTrace(paths[0], paths[1]);
+    }
+
+    // Service mode: producer threads submit the requests instead
+    int serviceThreads = 0;
+    int serviceRequests = 0;
+    int serviceDepth = 0;
+    if (!service.empty()) {
+        if (sscanf(service.c_str(), "%d,%d,%d", &serviceThreads, &serviceRequests, &serviceDepth) != 3 ||
+            serviceThreads < 1 || serviceThreads > 256 || serviceRequests < 0 || serviceDepth < 1) {
+            cerr << "Service must be threads,requests,depth with 1 to 256 threads and a depth of at least 1"
+                 << " (got " << service << ")" << endl;
+            return 1;
+        }
+        if (replicas > 0 || !compare.empty() || device != "disk" || !traceFile.empty()) {
+            cerr << "Service mode runs one disk on submitted requests only" << endl;
+            return 1;
+        }
+        addr = "-1";
+        addrDesc = "0,-1,0";
+        lateAddrDesc = "0,-1,0";
+    }
+    if (antic > 0 && thinkTime < 0) {
+        cerr << "Anticipation waits for a stream's next request, so -I needs closed-loop streams from -T" << endl;
+        return 1;
+    }
+    if (realtime != 0 && (replicas > 0 || !compare.empty() || device != "disk")) {
+        cerr << "Real-time pacing runs one disk" << endl;
+        return 1;
+    }
+
+    // A drive profile replaces the options it sets
+    shared_ptr<const DriveProfile> profile;
+    if (!profileSpec.empty()) {
+        size_t colon = profileSpec.rfind(':');
+        string path = profileSpec.substr(0, colon);
+        map<string, shared_ptr<const DriveProfile>> profiles = LoadProfiles(path);
+        if (colon == string::npos && profiles.size() == 1) {
+            profile = profiles.begin()->second;
+        } else if (colon != string::npos && profiles.count(profileSpec.substr(colon + 1))) {
+            profile = profiles[profileSpec.substr(colon + 1)];
+        } else if (colon == string::npos) {
+            cerr << "Profile file " << path << " has " << profiles.size() << " profiles; choose one with FILE:NAME" << endl;
+            return 1;
+        } else {
+            cerr << "No profile " << profileSpec.substr(colon + 1) << " in " << path << endl;
+            return 1;
+        }
+        ostringstream desc;
+        desc << profile->rpm << ","
+             << (profile->seekMs > 0 ? profile->seekMs : profile->seekCurveMs[0]) << ","
+             << profile->blockKiB;
+        units = desc.str();
+        if (!profile->zoning.empty()) {
+            zoning = profile->zoning;
+        }
+        if (profile->skew >= 0) {
+            skewOffset = profile->skew;
+        }
+        if (profile->rotateSpeed > 0) {
+            ostringstream speed;
+            speed << profile->rotateSpeed;
+            rotSpeed = speed.str();
+        }
+        if (profile->cacheBlocks >= 0) {
+            size_t comma = tier.find(',');
+            tier = to_string(profile->cacheBlocks) + (comma == string::npos ? "" : tier.substr(comma));
+        }
+    }
+
     // Set random seed
     srand(seed);
 
@@ -744,6 +5266,75 @@ int main(int argc, char* argv[]) {
     cout << "OPTIONS zoning " << zoning << endl;
     cout << "OPTIONS lateAddr " << lateAddr << endl;
     cout << "OPTIONS lateAddrDesc " << lateAddrDesc << endl;
+    if (policy == "DEADLINE") {
+        cout << "OPTIONS deadline " << deadline << endl;
+    }
+    if (policy == "KYBER") {
+        cout << "OPTIONS kyber " << kyber << endl;
+    }
+    if (policy == "OPT" || compare.find("OPT") != string::npos) {
+        cout << "OPTIONS opt " << optParams << endl;
+    }
+    if (policy == "LSATF" || compare.find("LSATF") != string::npos) {
+        cout << "OPTIONS lookahead " << lookahead << endl;
+    }
+    if (tables > 0) {
+        cout << "OPTIONS tables " << tables << endl;
+    }
+    if (!units.empty()) {
+        cout << "OPTIONS units " << units << endl;
+    }
+    if (profile) {
+        cout << "OPTIONS profile " << profileSpec << endl;
+    }
+    if (!traceFile.empty()) {
+        cout << "OPTIONS trace " << traceFile << endl;
+    }
+    if (pipeline) {
+        cout << "OPTIONS pipeline true" << endl;
+    }
+    if (!service.empty()) {
+        cout << "OPTIONS service " << service << endl;
+    }
+    if (realtime != 0) {
+        cout << "OPTIONS realtime " << realtime << endl;
+    }
+    if (maxMerge > 1) {
+        cout << "OPTIONS maxMerge " << maxMerge << endl;
+    }
+    if (lengthDesc != "1,1") {
+        cout << "OPTIONS lengthDesc " << lengthDesc << endl;
+    }
+    if (dist != "uniform") {
+        cout << "OPTIONS dist " << dist << endl;
+    }
+    if (sample > 0) {
+        cout << "OPTIONS sample " << sample << endl;
+        cout << "OPTIONS sampleFile " << sampleFile << endl;
+    }
+    if (replicas > 0) {
+        cout << "OPTIONS replicas " << replicas << endl;
+        cout << "OPTIONS precision " << precision << endl;
+    }
+    if (!compare.empty()) {
+        cout << "OPTIONS compare " << compare << endl;
+    }
+    if (device != "disk") {
+        cout << "OPTIONS device " << device << endl;
+        cout << "OPTIONS flash " << flash << endl;
+        cout << "OPTIONS flashTiming " << flashTiming << endl;
+    }
+    if (tier != "0,2,20,40") {
+        cout << "OPTIONS tier " << tier << endl;
+    }
+    if (thinkTime >= 0 || antic > 0) {
+        cout << "OPTIONS thinkTime " << thinkTime << endl;
+        cout << "OPTIONS antic " << antic << endl;
+    }
+    if (streamWeights != "1" || policy == "BFQ") {
+        cout << "OPTIONS weights " << streamWeights << endl;
+        cout << "OPTIONS fairBudget " << fairBudget << endl;
+    }
     cout << endl;
 
     if (window == 0) {
@@ -751,6 +5342,34 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if (device != "disk" && device != "flash") {
+        cerr << "Device (" << device << ") must be disk or flash" << endl;
+        return 1;
+    }
+
+    if (replicas < 0 || (replicas > 0 && device != "disk")) {
+        cerr << "Replicas (" << replicas << ") must be positive, and are only run on the disk" << endl;
+        return 1;
+    }
+
+    vector<string> comparePolicies;
+    if (!compare.empty()) {
+        stringstream ss(compare);
+        string name;
+        const set<string> known = {"FIFO", "SSTF", "SATF", "BSATF", "DEADLINE", "BFQ", "KYBER", "OPT", "LSATF"};
+        while (getline(ss, name, ',')) {
+            if (!known.count(name)) {
+                cerr << "Policy (" << name << ") not implemented" << endl;
+                return 1;
+            }
+            comparePolicies.push_back(name);
+        }
+        if (comparePolicies.empty() || device != "disk" || replicas > 0) {
+            cerr << "Compare needs at least one policy, runs on the disk only, and not with replicas" << endl;
+            return 1;
+        }
+    }
+
     if (graphics && !compute) {
         cout << "\nWARNING: Graphics mode not supported in C++ version (console only)\n" << endl;
         cout << "Setting compute flag to True\n" << endl;
@@ -758,12 +5377,101 @@ int main(int argc, char* argv[]) {
     }
 
     // Create disk simulator
-    Disk d(addr, addrDesc, lateAddr, lateAddrDesc, policy,
-           stod(seekSpeed), stod(rotSpeed), skewOffset, window,
-           compute, false, zoning);
+    DiskConfig config;
+    config.addr = addr;
+    config.addrDesc = addrDesc;
+    config.lateAddr = lateAddr;
+    config.lateAddrDesc = lateAddrDesc;
+    config.policy = policy;
+    config.seekSpeed = stod(seekSpeed);
+    config.rotateSpeed = stod(rotSpeed);
+    config.skew = skewOffset;
+    config.window = window;
+    config.compute = compute;
+    config.graphics = false;
+    config.zoning = zoning;
+    config.deadline = deadline;
+    config.streamWeights = streamWeights;
+    config.fairBudget = fairBudget;
+    config.kyber = kyber;
+    config.opt = optParams;
+    config.lookahead = lookahead;
+    config.tables = tables;
+    config.units = units;
+    config.profile = profile;
+    config.pipeline = pipeline;
+    config.serviceDepth = serviceDepth;
+    config.realtime = realtime;
+    if (!traceFile.empty()) {
+        if (device == "flash") {
+            cerr << "Traces replay on the disk only" << endl;
+            return 1;
+        }
+        if (IsBinaryTrace(traceFile)) {
+            config.trace = make_shared<const TraceReader>(traceFile);
+        } else if (replicas > 0 || !comparePolicies.empty()) {
+            cerr << "A text trace replays on one disk; convert it with -J for -r or -y" << endl;
+            return 1;
+        } else {
+            config.textTrace = make_shared<TraceParser>(traceFile);
+        }
+    }
+    config.thinkTime = thinkTime;
+    config.antic = antic;
+    config.maxMerge = maxMerge;
+    config.lengthDesc = lengthDesc;
+    config.device = device;
+    config.flash = flash;
+    config.flashTiming = flashTiming;
+    config.tier = tier;
+    config.dist = dist;
+    config.sample = sample;
+    config.sampleFile = sampleFile;
+
+    if (replicas > 0) {
+        return RunReplicas(config, seed, replicas, precision);
+    }
+    if (!comparePolicies.empty()) {
+        return RunComparison(config, comparePolicies);
+    }
+    Disk d(config);
+
+    // Each producer submits random one-block reads on its own stream,
+    // waiting whenever the device is full; paced, each waits for its read
+    // to complete before the next, as a synchronous client would
+    if (serviceDepth > 0) {
+        vector<thread> producers;
+        for (int t = 0; t < serviceThreads; t++) {
+            producers.push_back(thread([&d, t, seed, serviceRequests, realtime] {
+                mt19937 rng(seed * 1000 + t);
+                uniform_int_distribution<int> blocks(0, d.MaxBlock());
+                for (int i = 0; i < serviceRequests; i++) {
+                    if (realtime > 0) {
+                        d.SubmitAsync(blocks(rng), 1, false, t).wait();
+                    } else {
+                        d.Submit(blocks(rng), 1, false, t);
+                    }
+                }
+            }));
+        }
+        thread closer([&d, &producers] {
+            for (thread& producer : producers) {
+                producer.join();
+            }
+            d.Close();
+        });
+        d.Go();
+        closer.join();
+        return 0;
+    }
 
     // Run simulation
-    d.Go();
+    if (device == "flash") {
+        FlashDevice f(config, d.Requests(), d.LateRequests(), d.Streams(), d.MaxBlock() + 1);
+        f.Go();
+    } else {
+        d.Go();
+    }
 
     return 0;
 }